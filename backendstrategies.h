@@ -83,12 +83,12 @@ public:
         if (const QMailMessagePart *part = dynamic_cast<const QMailMessagePart*>(body_container)) {
             qDebug() << "@backend_strategy::DownloadMessageBody:"
                      << "Downloading part" << part->location().toString(true);
-            manager->retrieveMessagePart(part->location());
+            manager->retrieveMessagePart(message.parentAccountId(), part->location());
         }
         else {
             qDebug() << "@backend_strategy::DownloadMessageBody:"
                      << "Downloading message" << message.id();
-            manager->retrieveMessages(QMailMessageIdList() << message.id(),
+            manager->retrieveMessages(message.parentAccountId(), QMailMessageIdList() << message.id(),
                                       QMailRetrievalAction::Content);
         }
     }
@@ -99,11 +99,11 @@ public:
 class DownloadMessagePart
 {
 public:
-    void operator()(const QMailMessagePart::Location &location)
+    void operator()(const QMailAccountId &account_id, const QMailMessagePart::Location &location)
     {
         qDebug() << "@backend_strategy::DownloadMessagePart:"
                  << "Downloading part" << location.toString(true);
-        ServiceActionManager::instance()->retrieveMessagePart(location);
+        ServiceActionManager::instance()->retrieveMessagePart(account_id, location);
     }
 };
 
@@ -66,6 +66,7 @@ public slots:
     virtual void activityChanged(quint64,QMailServiceAction::Activity) {}
     virtual void connectivityChanged(quint64,QMailServiceAction::Connectivity) {}
     virtual void progressChanged(quint64,uint,uint) {}
+    virtual void aggregateProgressChanged(uint,uint) {}
     virtual void statusChanged(quint64,const QMailServiceAction::Status &) {}
 };
 
@@ -245,8 +246,9 @@ public:
         QVariant data = model_index.data(models::AttachmentList::LocationRole);
         data.canConvert<QMailMessagePart::Location>();
         QMailMessagePart::Location location = data.value<QMailMessagePart::Location>();
+        const QMailAccountId &account_id = model_index.data(models::AttachmentList::AccountIdRole).value<QMailAccountId>();
         StrategyType strategy;
-        strategy(location);
+        strategy(account_id, location);
     }
 };
 
@@ -351,7 +353,8 @@ public:
             }
         // NOTE: fall-through
         case QMailServiceAction::Failed:
-            if (!mProgressWidget.isNull()) {
+            // unfiltered, other operations may still run: aggregateProgressChanged() hides it
+            if (0 != mFilter && !mProgressWidget.isNull()) {
                 mProgressWidget->hide();
                 mProgressWidget->reset();
             }
@@ -374,6 +377,19 @@ public:
         mProgressWidget->setMaximum(total);
     }
 
+    void aggregateProgressChanged(uint value, uint total)
+    {
+        if (mProgressWidget.isNull() || 0 != mFilter) return;
+        if (0 == total) {  // nothing is running any more
+            mProgressWidget->hide();
+            mProgressWidget->reset();
+            return;
+        }
+        mProgressWidget->show();
+        mProgressWidget->setValue(value);
+        mProgressWidget->setMaximum(total);
+    }
+
     void statusChanged(quint64 serial, const QMailServiceAction::Status &status)
     {
         if (mMessageWidget.isNull() || (0 != mFilter && serial != mFilter)) return;
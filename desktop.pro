@@ -9,8 +9,10 @@ SOURCES += \
     application.cpp \
     main.cpp\
     serviceactionmanager.cpp \
+    messageserver.cpp \
     uimanager.cpp \
     view.cpp \
+    models/folderindex.cpp \
     models/folderlistmodel.cpp \
     models/folderstreemodel.cpp \
     widgets/combobox.cpp \
@@ -22,6 +24,9 @@ SOURCES += \
     models/attachmentlistmodel.cpp \
     widgets/attachmentlistdelegate.cpp \
     models/messagelistmodel.cpp \
+    models/messagelistcache.cpp \
+    models/progressinfo.cpp \
+    models/viewedmessage.cpp \
     widgets/messagewidget.cpp \
     utils.cpp
 
@@ -30,9 +35,11 @@ HEADERS  += \
     backendstrategies.h \
     context.h \
     serviceactionmanager.h \
+    messageserver.h \
     uimanager.h \
     uistrategies.h \
     view.h \
+    models/folderindex.h \
     models/folderlistmodel.h \
     models/folderstreemodel.h \
     widgets/combobox.h \
@@ -45,6 +52,8 @@ HEADERS  += \
     models/attachmentlistmodel.h \
     widgets/attachmentlistdelegate.h \
     models/messagelistmodel.h \
+    models/messagelistcache.h \
+    models/viewedmessage.h \
     widgets/messagewidget.h \
     utils.h
 
@@ -54,6 +63,13 @@ FORMS += \
 
 QMAKE_CXXFLAGS += -std=c++0x
 
+# in-process messageserver stand-in, see FakeMessageServer
+fakeserver {
+    DEFINES += F2_FAKE_MESSAGESERVER
+    SOURCES += fakemessageserver.cpp
+    HEADERS += fakemessageserver.h
+}
+
 profile {
     QMAKE_CXXFLAGS += -pg
     QMAKE_LFLAGS += -pg
@@ -0,0 +1,158 @@
+#include "fakemessageserver.h"
+
+#define CONNECT(a,b,c,d) if (!QObject::connect(a,b,c,d)) { Q_ASSERT (false); }
+
+
+namespace {
+const int TICK_INTERVAL = 10;  // ms
+}
+
+
+
+FakeMessageServer::FakeMessageServer(QObject *parent)
+  : MessageServer (parent),
+    mRequestCount (0)
+{
+    mClock.start();
+    mTimer.setInterval(TICK_INTERVAL);
+    CONNECT (&mTimer, SIGNAL(timeout()), this, SLOT(on_tick()));
+}
+
+
+void FakeMessageServer::retrieveFolderList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, bool descending)
+{
+    Q_UNUSED (account_id);
+    Q_UNUSED (folder_id);
+    Q_UNUSED (descending);
+    _accept(serial);
+}
+
+
+void FakeMessageServer::retrieveMessageList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, uint minimum, const QMailMessageSortKey &sort)
+{
+    Q_UNUSED (account_id);
+    Q_UNUSED (folder_id);
+    Q_UNUSED (minimum);
+    Q_UNUSED (sort);
+    _accept(serial);
+}
+
+
+void FakeMessageServer::retrieveMessagePart(quint64 serial, const QMailMessagePart::Location &location)
+{
+    Q_UNUSED (location);
+    _accept(serial);
+}
+
+
+void FakeMessageServer::retrieveMessagePartRange(quint64 serial, const QMailMessagePart::Location &location, uint minimum)
+{
+    Q_UNUSED (location);
+    Q_UNUSED (minimum);
+    _accept(serial);
+}
+
+
+void FakeMessageServer::retrieveMessageRange(quint64 serial, const QMailMessageId &message_id, uint minimum)
+{
+    Q_UNUSED (message_id);
+    Q_UNUSED (minimum);
+    _accept(serial);
+}
+
+
+void FakeMessageServer::retrieveMessages(quint64 serial, const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification spec)
+{
+    Q_UNUSED (message_ids);
+    Q_UNUSED (spec);
+    _accept(serial);
+}
+
+
+void FakeMessageServer::cancelTransfer(quint64 serial)
+{
+    QHash<quint64, Transfer>::iterator it = mTransfers.find(serial);
+    if (mTransfers.end() != it)
+        it->cancelled = true;  // confirmed on the next tick
+}
+
+
+void FakeMessageServer::on_tick()
+{
+    const qint64 now = mClock.elapsed();
+
+    // handlers may issue or cancel requests, so only serials are iterated
+    foreach (quint64 serial, mTransfers.keys()) {
+
+        QHash<quint64, Transfer>::iterator it = mTransfers.find(serial);
+        if (mTransfers.end() == it)
+            continue;
+
+        Transfer &transfer = *it;
+        if (transfer.cancelled) {
+            _finish(serial, QMailServiceAction::Status::ErrCancel);
+            continue;
+        }
+
+        if (transfer.startedAt < 0) {
+            if (now - transfer.acceptedAt < transfer.script.latency)
+                continue;
+            transfer.startedAt = now;
+            emit activityChanged(serial, QMailServiceAction::InProgress);
+            continue;  // the handler may have cancelled it
+        }
+
+        const Script &script = transfer.script;
+        uint done = script.bytes;
+        if (script.byteRate > 0)
+            done = uint(qMin(quint64(script.bytes), quint64(now - transfer.startedAt) * script.byteRate / 1000));
+
+        if (done != transfer.done || 0 == script.bytes) {
+            transfer.done = done;
+            emit progressChanged(serial, done, script.bytes);
+        }
+
+        it = mTransfers.find(serial);
+        if (mTransfers.end() == it || it->cancelled)
+            continue;
+
+        if (it->done >= it->script.bytes)
+            _finish(serial, it->script.error);
+    }
+
+    if (mTransfers.isEmpty())
+        mTimer.stop();
+}
+
+
+void FakeMessageServer::_accept(quint64 serial)
+{
+    mRequestCount++;
+
+    Transfer transfer;
+    transfer.script = mScripts.isEmpty() ? mDefaultScript : mScripts.dequeue();
+    transfer.acceptedAt = mClock.elapsed();
+    transfer.startedAt = -1;
+    transfer.done = 0;
+    transfer.cancelled = false;
+    mTransfers.insert(serial, transfer);
+
+    if (!mTimer.isActive())
+        mTimer.start();
+}
+
+
+void FakeMessageServer::_finish(quint64 serial, QMailServiceAction::Status::ErrorCode error)
+{
+    mTransfers.remove(serial);
+
+    if (QMailServiceAction::Status::ErrNoError == error) {
+        emit activityChanged(serial, QMailServiceAction::Successful);
+        return;
+    }
+
+    const QMailServiceAction::Status status(error, QString("scripted failure"),
+                                            QMailAccountId(), QMailFolderId(), QMailMessageId());
+    emit statusChanged(serial, status);
+    emit activityChanged(serial, QMailServiceAction::Failed);
+}
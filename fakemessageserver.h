@@ -0,0 +1,85 @@
+#ifndef FAKEMESSAGESERVER_H
+#define FAKEMESSAGESERVER_H
+
+
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QQueue>
+#include <QTimer>
+
+#include "messageserver.h"
+
+
+
+/**
+ * In-process stand-in for the messageserver, for benchmarking the operation
+ * queue without a server process or a network.
+ *
+ * Every request plays a script: it turns InProgress after the script's
+ * latency, then "transfers" its bytes at the script's rate, reporting
+ * progress, and finally succeeds or fails with the script's error code.
+ * Scripts added with addScript() are used by the following requests in
+ * order, the default script by the rest. Signals are never emitted from
+ * within a request call, as with the real server.
+ */
+class FakeMessageServer : public MessageServer
+{
+    Q_OBJECT
+
+public:
+    struct Script
+    {
+        int latency;  // ms before the transfer starts
+        uint bytes;  // transfer size, the progress total
+        uint byteRate;  // bytes per second, 0 for no delay
+        QMailServiceAction::Status::ErrorCode error;  // ErrNoError to succeed
+        Script()
+          : latency (0), bytes (0), byteRate (0), error (QMailServiceAction::Status::ErrNoError) {}
+    };
+
+    explicit FakeMessageServer(QObject *parent=NULL);
+
+    void setDefaultScript(const Script &script) { mDefaultScript = script; }
+    void addScript(const Script &script) { mScripts.enqueue(script); }
+    /// how often transfers advance, 0 for every event loop iteration
+    void setTickInterval(int msecs) { mTimer.setInterval(qMax(0, msecs)); }
+    /// requests received so far, cancelled and failed ones included
+    int requestCount() const { return mRequestCount; }
+    int activeCount() const { return mTransfers.count(); }
+
+    void retrieveFolderList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, bool descending);
+    void retrieveMessageList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, uint minimum, const QMailMessageSortKey &sort);
+    void retrieveMessagePart(quint64 serial, const QMailMessagePart::Location &location);
+    void retrieveMessagePartRange(quint64 serial, const QMailMessagePart::Location &location, uint minimum);
+    void retrieveMessageRange(quint64 serial, const QMailMessageId &message_id, uint minimum);
+    void retrieveMessages(quint64 serial, const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification spec);
+    void cancelTransfer(quint64 serial);
+
+private slots:
+    void on_tick();
+
+private:
+    struct Transfer
+    {
+        Script script;
+        qint64 acceptedAt;
+        qint64 startedAt;  // -1 until InProgress
+        uint done;
+        bool cancelled;
+    };
+
+    void _accept(quint64 serial);
+    void _finish(quint64 serial, QMailServiceAction::Status::ErrorCode error);
+
+    Script mDefaultScript;
+    QQueue<Script> mScripts;
+    QHash<quint64, Transfer> mTransfers;
+    QTimer mTimer;
+    QElapsedTimer mClock;
+    int mRequestCount;
+};
+
+
+
+#endif // FAKEMESSAGESERVER_H
@@ -0,0 +1,63 @@
+#include <qmfclient/qmailmessageserver.h>
+
+#include "messageserver.h"
+
+#define CONNECT(a,b,c,d) if (!QObject::connect(a,b,c,d)) { Q_ASSERT (false); }
+
+
+
+QmfMessageServer::QmfMessageServer(QObject *parent)
+  : MessageServer (parent),
+    mServer (new QMailMessageServer(this))
+{
+    CONNECT (mServer, SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)),
+             this, SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)));
+    CONNECT (mServer, SIGNAL(connectivityChanged(quint64,QMailServiceAction::Connectivity)),
+             this, SIGNAL(connectivityChanged(quint64,QMailServiceAction::Connectivity)));
+    CONNECT (mServer, SIGNAL(progressChanged(quint64,uint,uint)),
+             this, SIGNAL(progressChanged(quint64,uint,uint)));
+    CONNECT (mServer, SIGNAL(statusChanged(quint64,QMailServiceAction::Status)),
+             this, SIGNAL(statusChanged(quint64,QMailServiceAction::Status)));
+}
+
+
+void QmfMessageServer::retrieveFolderList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, bool descending)
+{
+    mServer->retrieveFolderList(serial, account_id, folder_id, descending);
+}
+
+
+void QmfMessageServer::retrieveMessageList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, uint minimum, const QMailMessageSortKey &sort)
+{
+    mServer->retrieveMessageList(serial, account_id, folder_id, minimum, sort);
+}
+
+
+void QmfMessageServer::retrieveMessagePart(quint64 serial, const QMailMessagePart::Location &location)
+{
+    mServer->retrieveMessagePart(serial, location);
+}
+
+
+void QmfMessageServer::retrieveMessagePartRange(quint64 serial, const QMailMessagePart::Location &location, uint minimum)
+{
+    mServer->retrieveMessagePartRange(serial, location, minimum);
+}
+
+
+void QmfMessageServer::retrieveMessageRange(quint64 serial, const QMailMessageId &message_id, uint minimum)
+{
+    mServer->retrieveMessageRange(serial, message_id, minimum);
+}
+
+
+void QmfMessageServer::retrieveMessages(quint64 serial, const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification spec)
+{
+    mServer->retrieveMessages(serial, message_ids, spec);
+}
+
+
+void QmfMessageServer::cancelTransfer(quint64 serial)
+{
+    mServer->cancelTransfer(serial);
+}
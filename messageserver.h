@@ -0,0 +1,65 @@
+#ifndef MESSAGESERVER_H
+#define MESSAGESERVER_H
+
+
+
+#include <QObject>
+#include <qmfclient/qmailserviceaction.h>
+
+class QMailMessageServer;
+
+
+
+/**
+ * The part of the messageserver interface ServiceActionManager relies on.
+ * Lets the manager run against the real messageserver (QmfMessageServer) or
+ * an in-process fake (FakeMessageServer) for deterministic benchmarks.
+ */
+class MessageServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MessageServer(QObject *parent=NULL) : QObject (parent) {}
+    virtual ~MessageServer() {}
+
+    virtual void retrieveFolderList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, bool descending) = 0;
+    virtual void retrieveMessageList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, uint minimum, const QMailMessageSortKey &sort) = 0;
+    virtual void retrieveMessagePart(quint64 serial, const QMailMessagePart::Location &location) = 0;
+    virtual void retrieveMessagePartRange(quint64 serial, const QMailMessagePart::Location &location, uint minimum) = 0;
+    virtual void retrieveMessageRange(quint64 serial, const QMailMessageId &message_id, uint minimum) = 0;
+    virtual void retrieveMessages(quint64 serial, const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification spec) = 0;
+    virtual void cancelTransfer(quint64 serial) = 0;
+
+signals:
+    void activityChanged(quint64, QMailServiceAction::Activity);
+    void connectivityChanged(quint64, QMailServiceAction::Connectivity);
+    void progressChanged(quint64, uint, uint);
+    void statusChanged(quint64, const QMailServiceAction::Status &);
+};
+
+
+
+/** Forwards to QMailMessageServer, i.e. the messageserver process. */
+class QmfMessageServer : public MessageServer
+{
+    Q_OBJECT
+
+public:
+    explicit QmfMessageServer(QObject *parent=NULL);
+
+    void retrieveFolderList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, bool descending);
+    void retrieveMessageList(quint64 serial, const QMailAccountId &account_id, const QMailFolderId &folder_id, uint minimum, const QMailMessageSortKey &sort);
+    void retrieveMessagePart(quint64 serial, const QMailMessagePart::Location &location);
+    void retrieveMessagePartRange(quint64 serial, const QMailMessagePart::Location &location, uint minimum);
+    void retrieveMessageRange(quint64 serial, const QMailMessageId &message_id, uint minimum);
+    void retrieveMessages(quint64 serial, const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification spec);
+    void cancelTransfer(quint64 serial);
+
+private:
+    QMailMessageServer *mServer;
+};
+
+
+
+#endif // MESSAGESERVER_H
@@ -16,8 +16,6 @@ namespace models {
 AttachmentList::AttachmentList(QObject *parent)
   : QAbstractItemModel (parent)
 {
-    CONNECT (ServiceActionManager::instance(), SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)),
-             this, SLOT(on_activityChanged(quint64,QMailServiceAction::Activity)));
 }
 
 
@@ -61,45 +59,31 @@ QVariant AttachmentList::data(const QModelIndex &index, int role) const
     switch (role) {
 
     case Qt::DisplayRole:
-        return mModel->message().partAt(item->location).displayName();
+        return item->attachment.displayName;
 
     case MimeTypeRole:
-        return QString(mModel->message().partAt(item->location).contentType().content());
+        return item->attachment.mimeType;
 
-    case SizeRole: {
-        const QMailMessagePart &part = mModel->message().partAt(item->location);
+    case SizeRole:
+        return item->attachment.size;
 
-        if (part.contentDisposition().size() != -1)
-            return part.contentDisposition().size();
+    case IsDownloadedRole:
+        return item->attachment.downloaded;
 
-        // If size is -1 (unknown) try finding out attachment's body size
-        if (part.contentAvailable())
-            return part.hasBody() ? part.body().length() : 0;
-
-        return -1;
-    }
     case LocationAsStringRole:
         return item->location.toString(true);
 
     case LocationRole:
         return qVariantFromValue(item->location);
 
-    case ProgressInfoRole: {
-
-        if (mProgressInfoCache.contains(item))
-            return mProgressInfoCache[item];
+    case AccountIdRole:
+        return qVariantFromValue(mModel->metaData().parentAccountId());
 
-        const QList<quint64> &operations = ServiceActionManager::instance()->operations(item->location);
-        if (operations.isEmpty())
+    case ProgressInfoRole: {
+        const ProgressInfo &progress = ServiceActionManager::instance()->progress(item->location);
+        if (progress.isNull())
             return QVariant();
-
-        if (mIndexCache.isEmpty())
-            connectCache();
-
-        foreach (quint64 serial, operations)
-            mIndexCache[serial] = item;
-
-        return mProgressInfoCache[item] = ProgressInfo(operations[0]);
+        return progress;
     }
     default:
         return QVariant();
@@ -115,142 +99,74 @@ QModelIndex AttachmentList::index(int row, int column, const QModelIndex &parent
 }
 
 
-void AttachmentList::connectCache() const
-{
-    CONNECT (ServiceActionManager::instance(), SIGNAL(progressChanged(quint64,uint,uint)),
-             this, SLOT(on_progressChanged(quint64,uint,uint)));
-    CONNECT (this, SIGNAL(modelReset()),
-             this, SLOT(on_modelReset()));
-    CONNECT (this, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
-             this, SLOT(on_rowsAboutToBeRemoved(QModelIndex,int,int)));
-}
-
-
-void AttachmentList::disconnectCache() const
-{
-    DISCONNECT (ServiceActionManager::instance(), SIGNAL(progressChanged(quint64,uint,uint)),
-               this, SLOT(on_progressChanged(quint64,uint,uint)));
-    DISCONNECT (this, SIGNAL(modelReset()),
-               this, SLOT(on_modelReset()));
-    DISCONNECT (this, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
-               this, SLOT(on_rowsAboutToBeRemoved(QModelIndex,int,int)));
-}
-
-
 void AttachmentList::on_messageReset()
 {
     beginResetModel();
 
+    ServiceActionManager *manager = ServiceActionManager::instance();
+    manager->unsubscribe(this);
+
     while (!mItems.isEmpty())
          delete mItems.takeFirst();
 
-    const QList<QMailMessagePart::Location> &locations = mModel->message().findAttachmentLocations();
-    for (int i=0; i < locations.count(); ++i) {
+    const QList<ViewedMessage::Attachment> &attachments = mModel->attachments();
+    for (int i=0; i < attachments.count(); ++i) {
         Item *item = new Item;
-        item->location = locations[i];
+        item->attachment = attachments[i];
+        item->location = attachments[i].location;
+        item->locationKey = item->location.toString(true);
         item->index = createIndex(i, 0, item);
         mItems << item;
+        manager->subscribe(item->location, this);
     }
 
     endResetModel();
 }
 
 
+/**
+ * Downloads change the descriptors (downloaded, size) of the same parts, in
+ * place. Parts added or removed, the list is rebuilt.
+ */
 void AttachmentList::on_messageUpdated()
 {
-    /** TODO:
-     * beginInsertRows/insertRows
-     * beginRemoveRows/removeRows
-     * dataChanged
-     */
-}
-
-
-void AttachmentList::on_modelReset()
-{
-    if (!mIndexCache.isEmpty())
-        disconnectCache();
-    mIndexCache.clear();
-    mProgressInfoCache.clear();
-}
-
-
-void AttachmentList::on_rowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
-{
-    Q_UNUSED (parent);
-    Q_ASSERT (!mModel.isNull());
-    Q_ASSERT (0 <= first && last < mItems.count());
-
-    for (int i = first; i <= last; i++) {
-
-        const Item *item = mItems[i];
-        quint64 serial = mProgressInfoCache.value(item).serial();
-        mProgressInfoCache.remove(item);
-        mIndexCache.remove(serial);
+    const QList<ViewedMessage::Attachment> &attachments = mModel->attachments();
+    if (attachments.count() != mItems.count()) {
+        on_messageReset();
+        return;
+    }
+    for (int i=0; i < attachments.count(); ++i) {
+        if (attachments[i].location.toString(true) != mItems[i]->locationKey) {
+            on_messageReset();
+            return;
+        }
     }
 
-    if (mIndexCache.isEmpty())
-        disconnectCache();
-}
-
-
-void AttachmentList::on_progressChanged(quint64 serial, uint value, uint total)
-{
-    if (!mIndexCache.contains(serial))
-        return;
+    for (int i=0; i < attachments.count(); ++i) {
+        const ViewedMessage::Attachment &attachment = attachments[i];
+        Item *item = mItems[i];
+        if (attachment.size == item->attachment.size
+         && attachment.downloaded == item->attachment.downloaded
+         && attachment.displayName == item->attachment.displayName
+         && attachment.mimeType == item->attachment.mimeType)
+            continue;
 
-    const Item *item = mIndexCache[serial];
-    mProgressInfoCache[item].setInfo(serial, value, total);
-    emit dataChanged(item->index, item->index);
+        item->attachment = attachment;
+        emit dataChanged(item->index, item->index);
+    }
 }
 
 
-void AttachmentList::on_activityChanged(quint64 serial, QMailServiceAction::Activity activity)
+/// the progress itself is read from the manager's registry
+void AttachmentList::progressInfoChanged(const QMailMessageIdList &ids, const QString &location)
 {
-    switch (activity) {
-
-    case QMailServiceAction::Pending: {
+    Q_UNUSED (ids);
 
-        if (mIndexCache.contains(serial))
+    foreach (const Item *item, mItems) {
+        if (item->locationKey == location) {
+            emit dataChanged(item->index, item->index);
             return;
-
-        const auto *operation = ServiceActionManager::instance()->operationInfo(serial);
-        /// FIXME: Q_ASSERT (operation);
-        if (!operation)
-            return;
-
-        const QMailMessagePart::Location &location = operation->messagePartLocation();
-        if (!location.isValid() || location.containingMessageId() != mModel->message().id())
-            return;
-
-        const QString &location_str = location.toString(true);
-        foreach (const Item *item, mItems) {
-            if (item->location.toString(true) == location_str) {
-                connectCache();
-                mIndexCache[serial] = item;
-                emit dataChanged(item->index, item->index);
-                return;
-            }
         }
-    }   return;
-
-    case QMailServiceAction::Successful:
-    case QMailServiceAction::Failed: {
-
-        if (!mIndexCache.contains(serial))
-            return;
-
-        const Item *item = mIndexCache[serial];
-        mProgressInfoCache.remove(item);
-        mIndexCache.remove(serial);
-
-        if (mIndexCache.isEmpty())
-            disconnectCache();
-
-        emit dataChanged(item->index, item->index);
-    }   return;
-
-    default: ;
     }
 }
 
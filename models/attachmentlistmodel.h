@@ -9,6 +9,7 @@
 #include <qmfclient/qmailmessage.h>
 
 // project
+#include "serviceactionmanager.h"
 #include "messagemodel.h"
 #include "progressinfo.h"
 
@@ -20,7 +21,7 @@ namespace models {
  * Provides QAbstractItemModel interface to a MessageModel
  * (see http://en.wikipedia.org/wiki/Adapter_pattern)
  */
-class AttachmentList : public QAbstractItemModel/*QAbstractListModel*/
+class AttachmentList : public QAbstractItemModel/*QAbstractListModel*/, public ServiceActionManager::Subscriber
 {
     Q_OBJECT
 
@@ -33,7 +34,8 @@ public:
         LocationRole,
         SaveFolderRole,
         DownloaderRole,
-        ProgressInfoRole
+        ProgressInfoRole,
+        AccountIdRole
     };
 
     explicit AttachmentList(QObject *parent = 0);
@@ -49,27 +51,18 @@ public:
     virtual QModelIndex parent(const QModelIndex &/*child*/) const { return QModelIndex(); }
     virtual int columnCount(const QModelIndex &parent = QModelIndex()) const { return parent.isValid() ? 0 : 1; }
 
-signals:
+    virtual void progressInfoChanged(const QMailMessageIdList &ids, const QString &location);
 
-private:
-    void connectCache() const;
-    void disconnectCache() const;
+signals:
 
 private slots:
     void on_messageReset();
     void on_messageUpdated();
 
-    void on_modelReset();
-    void on_rowsAboutToBeRemoved(const QModelIndex &parent, int first, int last);
-    void on_progressChanged(quint64 serial, uint value, uint total);
-    void on_activityChanged(quint64, QMailServiceAction::Activity);
-
 private:
     QPointer<MessageModel>  mModel;
-    struct Item { QModelIndex index; QMailMessagePart::Location location; };
-    QList<const Item*> mItems;
-    mutable QHash<const Item*, ProgressInfo> mProgressInfoCache;
-    mutable QHash<quint64, const Item*> mIndexCache;
+    struct Item { QModelIndex index; QMailMessagePart::Location location; QString locationKey; ViewedMessage::Attachment attachment; };
+    QList<Item*> mItems;
 };
 
 
@@ -0,0 +1,686 @@
+// Qt
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QVector>
+#include <QtAlgorithms>
+
+// QMF
+#include <qmfclient/qmailstore.h>  // QMailStore
+
+// project
+#include "folderindex.h"
+
+
+#define CONNECT(a,b,c,d) if (!QObject::connect(a,b,c,d)) { Q_ASSERT (false); }
+
+namespace
+{
+    // folders counted per event loop iteration, two queries each
+    const int LOAD_CHUNK = 32;
+}
+
+namespace models
+{
+
+namespace internal
+{
+    /**
+     * Nodes of the tree in contiguous storage, referred to by their number,
+     * which is also the internalId of the models' indices. Node 0 is the root.
+     * Account and folder payloads live in arrays of their own, numbers of
+     * released nodes and payloads are reused.
+     *
+     * Every folder keeps the message counts of its own, which are rolled up
+     * into every node for its whole subtree.
+     */
+    class NodeTable
+    {
+    public:
+        typedef FolderIndex::Kind Kind;
+
+        struct Node
+        {
+            Kind kind;
+            int parent;
+            int row;  // in the parent's children
+            int payload;  // in accounts or folders, by kind
+            QVector<int> children;
+            int unread;  // subtree's
+            int total;
+        };
+
+        struct Counts
+        {
+            int unread;
+            int total;
+            Counts() : unread (0), total (0) {}
+        };
+
+        struct AccountData
+        {
+            QMailAccountId id;
+            QString name;
+        };
+
+        struct FolderData
+        {
+            QMailFolderId id;
+            QString displayName;
+            Counts own;
+            bool counted;
+            FolderData() : counted (false) {}
+        };
+
+        NodeTable()
+        {
+            Node root;
+            root.kind = FolderIndex::Root;
+            root.parent = -1;
+            root.row = 0;
+            root.payload = -1;
+            root.unread = 0;
+            root.total = 0;
+            nodes.append(root);
+        }
+
+        const Node & operator[](int node) const { return nodes[node]; }
+        Kind kind(int node) const { return nodes[node].kind; }
+        const AccountData & account(int node) const { return accounts[nodes[node].payload]; }
+        const FolderData & folder(int node) const { return folders[nodes[node].payload]; }
+        FolderData & folder(int node) { return folders[nodes[node].payload]; }
+
+        int accountNode(const QMailAccountId &id) const { return accountIndex.value(id, -1); }
+        int folderNode(const QMailFolderId &id) const { return folderIndex.value(id, -1); }
+
+        int addAccount(const QMailAccountId &id, const QString &name)
+        {
+            AccountData data;
+            data.id = id;
+            data.name = name;
+            const int node = addNode(FolderIndex::Account, FolderIndex::ROOT, allocate(accounts, freeAccounts, data));
+            accountIndex.insert(id, node);
+            return node;
+        }
+
+        int addFolder(int parent, const QMailFolderId &id, const QString &name)
+        {
+            FolderData data;
+            data.id = id;
+            data.displayName = name;
+            const int node = addNode(FolderIndex::Folder, parent, allocate(folders, freeFolders, data));
+            folderIndex.insert(id, node);
+            uncounted.append(id);
+            return node;
+        }
+
+        /// folders counted so far
+        QVector<int> countedFolders() const
+        {
+            QVector<int> res;
+            foreach (int node, folderIndex) {
+                if (folder(node).counted)
+                    res.append(node);
+            }
+            return res;
+        }
+
+        /// releases the children's subtrees, renumbering the rest
+        void removeChildren(int parent, int first, int last)
+        {
+            for (int i = first; i <= last; i++) {
+                const Node &child = nodes[nodes[parent].children[i]];
+                rollUp(parent, -child.unread, -child.total, NULL);
+                release(nodes[parent].children[i]);
+            }
+
+            QVector<int> &children = nodes[parent].children;
+            children.remove(first, last - first + 1);
+            for (int i = first; i < children.count(); i++)
+                nodes[children[i]].row = i;
+        }
+
+        /// sets the folder's own counts, collecting the nodes affected
+        void setCounts(int node, int unread, int total, QSet<int> *changed)
+        {
+            FolderData &data = folder(node);
+            const int unread_delta = unread - data.own.unread;
+            const int total_delta = total - data.own.total;
+            data.own.unread = unread;
+            data.own.total = total;
+            data.counted = true;
+            rollUp(node, unread_delta, total_delta, changed);
+        }
+
+        QList<QMailFolderId> uncounted;  // added, to be counted, in tree order
+
+    private:
+        void rollUp(int node, int unread, int total, QSet<int> *changed)
+        {
+            if (0 == unread && 0 == total)
+                return;
+
+            for (; node >= 0; node = nodes[node].parent) {
+                nodes[node].unread += unread;
+                nodes[node].total += total;
+                if (changed)
+                    changed->insert(node);
+            }
+        }
+
+        template <typename T>
+        static int allocate(QVector<T> &array, QVector<int> &unused, const T &data)
+        {
+            if (unused.isEmpty()) {
+                array.append(data);
+                return array.count() - 1;
+            }
+            const int res = unused.last();
+            unused.pop_back();
+            array[res] = data;
+            return res;
+        }
+
+        int addNode(Kind kind, int parent, int payload)
+        {
+            Node data;
+            data.kind = kind;
+            data.parent = parent;
+            data.row = nodes[parent].children.count();
+            data.payload = payload;
+            data.unread = 0;
+            data.total = 0;
+            const int node = allocate(nodes, freeNodes, data);
+            nodes[parent].children.append(node);
+            return node;
+        }
+
+        void release(int node)
+        {
+            foreach (int child, nodes[node].children)
+                release(child);
+
+            Node &data = nodes[node];
+            switch (data.kind) {
+            case FolderIndex::Account:
+                accountIndex.remove(accounts[data.payload].id);
+                accounts[data.payload] = AccountData();
+                freeAccounts.append(data.payload);
+                break;
+            case FolderIndex::Folder:
+                folderIndex.remove(folders[data.payload].id);
+                folders[data.payload] = FolderData();
+                freeFolders.append(data.payload);
+                break;
+            default:
+                Q_ASSERT (false);
+            }
+
+            data.kind = FolderIndex::Unused;
+            data.children.clear();
+            freeNodes.append(node);
+        }
+
+        QVector<Node> nodes;
+        QVector<AccountData> accounts;
+        QVector<FolderData> folders;
+        QVector<int> freeNodes;
+        QVector<int> freeAccounts;
+        QVector<int> freeFolders;
+        QHash<QMailAccountId, int> accountIndex;
+        QHash<QMailFolderId, int> folderIndex;
+    };
+}
+
+using namespace internal;
+
+
+namespace
+{
+    typedef QHash<QMailFolderId, QList<QMailFolder> > FolderChildren;
+
+    void attach_children(const FolderChildren &children, const QMailFolderId &folder_id, int parent, NodeTable *tree)
+    {
+        foreach (const QMailFolder &folder, children.value(folder_id)) {
+            const int node = tree->addFolder(parent, folder.id(), folder.displayName());
+            attach_children(children, folder.id(), node, tree);
+        }
+    }
+
+    /**
+     * Builds the folders in scope under the parent node with a single query,
+     * loading every folder once and assembling the hierarchy in memory.
+     */
+    void setup(const QMailFolderKey &scope, const QMailFolderId &folder_id, int parent, NodeTable *tree)
+    {
+        QMailFolderKey key
+                = scope
+                & QMailFolderKey(QMailFolderKey::status(QMailFolder::NonMail,
+                                                        QMailDataComparator::Excludes));
+
+        // store order is kept among siblings
+        FolderChildren children;
+        foreach (const QMailFolderId &id, QMailStore::instance()->queryFolders(key)) {
+            const QMailFolder folder(id);
+            children[folder.parentFolderId()] << folder;
+        }
+
+        attach_children(children, folder_id, parent, tree);
+    }
+}
+
+
+
+FolderIndex::FolderIndex(QObject *parent)
+  : QObject (parent),
+    mTree (new NodeTable)
+{
+    QMailStore *store = QMailStore::instance();
+
+    CONNECT (store, SIGNAL(accountsRemoved(QMailAccountIdList)),
+              this, SLOT(onAccountsRemoved(QMailAccountIdList)));
+    CONNECT (store, SIGNAL(foldersAdded(QMailFolderIdList)),
+              this, SLOT(onFoldersAdded(QMailFolderIdList)));
+    CONNECT (store, SIGNAL(foldersUpdated(QMailFolderIdList)),
+              this, SLOT(onFoldersUpdated(QMailFolderIdList)));
+    CONNECT (store, SIGNAL(foldersRemoved(QMailFolderIdList)),
+              this, SLOT(onFoldersRemoved(QMailFolderIdList)));
+    CONNECT (store, SIGNAL(messagesAdded(QMailMessageIdList)),
+              this, SLOT(onMessagesAdded(QMailMessageIdList)));
+    CONNECT (store, SIGNAL(messagesUpdated(QMailMessageIdList)),
+              this, SLOT(onMessagesUpdated(QMailMessageIdList)));
+    CONNECT (store, SIGNAL(messagesRemoved(QMailMessageIdList)),
+              this, SLOT(onMessagesRemoved(QMailMessageIdList)));
+    CONNECT (store, SIGNAL(messageStatusUpdated(QMailMessageIdList,quint64,bool)),
+              this, SLOT(onMessageStatusUpdated(QMailMessageIdList,quint64,bool)));
+    CONNECT (store, SIGNAL(messagePropertyUpdated(QMailMessageIdList,QMailMessageKey::Properties,QMailMessageMetaData)),
+              this, SLOT(onMessagePropertyUpdated(QMailMessageIdList,QMailMessageKey::Properties,QMailMessageMetaData)));
+
+    /// TODO: exclude disabled accounts
+    foreach (const QMailAccountId &id, store->queryAccounts()) {
+
+        const QMailAccount account(id);
+        const int node = mTree->addAccount(account.id(), account.name());
+        setup(QMailFolderKey::parentAccountId(account.id()), QMailFolderId(), node, mTree);
+    }
+
+    // the tree is shown with zero counts, they are filled in from the event loop
+    mLoadTimer.setInterval(0);
+    CONNECT (&mLoadTimer, SIGNAL(timeout()), this, SLOT(onLoadTimeout()));
+    mLoadTimer.start();
+}
+
+
+FolderIndex::~FolderIndex()
+{
+    delete mTree;
+}
+
+
+FolderIndex * FolderIndex::instance()
+{
+    static FolderIndex *self = NULL;
+    if (NULL == self)
+        self = new FolderIndex();
+    return self;
+}
+
+
+FolderIndex::Kind FolderIndex::kind(int node) const
+{
+    return mTree->kind(node);
+}
+
+
+int FolderIndex::parent(int node) const
+{
+    return (*mTree)[node].parent;
+}
+
+
+int FolderIndex::row(int node) const
+{
+    return (*mTree)[node].row;
+}
+
+
+int FolderIndex::childCount(int node) const
+{
+    return (*mTree)[node].children.count();
+}
+
+
+int FolderIndex::child(int node, int row) const
+{
+    return (*mTree)[node].children.value(row, -1);
+}
+
+
+QString FolderIndex::name(int node) const
+{
+    switch (mTree->kind(node)) {
+    case Account:
+        return mTree->account(node).name;
+    case Folder:
+        return mTree->folder(node).displayName;
+    default:
+        return QString();
+    }
+}
+
+
+QMailAccountId FolderIndex::accountId(int node) const
+{
+    const int account_node = accountOf(node);
+    return account_node < 0 ? QMailAccountId() : mTree->account(account_node).id;
+}
+
+
+QMailFolderId FolderIndex::folderId(int node) const
+{
+    return Folder == mTree->kind(node) ? mTree->folder(node).id : QMailFolderId();
+}
+
+
+int FolderIndex::accountNode(const QMailAccountId &id) const
+{
+    return mTree->accountNode(id);
+}
+
+
+int FolderIndex::folderNode(const QMailFolderId &id) const
+{
+    return mTree->folderNode(id);
+}
+
+
+int FolderIndex::unreadCount(int node) const
+{
+    return (*mTree)[node].unread;
+}
+
+
+int FolderIndex::totalCount(int node) const
+{
+    return (*mTree)[node].total;
+}
+
+
+int FolderIndex::ownUnreadCount(int node) const
+{
+    return Folder == mTree->kind(node) ? mTree->folder(node).own.unread : 0;
+}
+
+
+int FolderIndex::ownTotalCount(int node) const
+{
+    return Folder == mTree->kind(node) ? mTree->folder(node).own.total : 0;
+}
+
+
+int FolderIndex::accountOf(int node) const
+{
+    while (node >= 0 && Account != mTree->kind(node))
+        node = (*mTree)[node].parent;
+    return node;
+}
+
+
+void FolderIndex::removeRows(int parent, int first, int last)
+{
+    emit rowsAboutToBeRemoved(parent, first, last);
+    mTree->removeChildren(parent, first, last);
+    emit rowsRemoved(parent, first, last);
+}
+
+
+void FolderIndex::onAccountsRemoved(const QMailAccountIdList &list)
+{
+    foreach (const QMailAccountId &id, list) {
+        const int node = mTree->accountNode(id);
+        if (node < 0)
+            continue;
+
+        const int row = (*mTree)[node].row;
+        removeRows(ROOT, row, row);
+    }
+}
+
+
+void FolderIndex::onFoldersAdded(const QMailFolderIdList &list)
+{
+    QMap<int, QList<QMailFolder> > new_folders;
+
+    foreach (const QMailFolderId &id, list) {
+
+        if (mTree->folderNode(id) >= 0)
+            continue;
+
+        const QMailFolder folder(id);
+        const int parent_node = folder.parentFolderId().isValid()
+                ? mTree->folderNode(folder.parentFolderId())
+                : mTree->accountNode(folder.parentAccountId());
+        if (parent_node < 0)
+            continue;
+
+        new_folders[parent_node] << folder;
+    }
+
+    foreach (int parent_node, new_folders.keys()) {
+
+        const QList<QMailFolder> &folders = new_folders[parent_node];
+        int first = (*mTree)[parent_node].children.count();
+        int last = first + folders.count() - 1;
+        emit rowsAboutToBeInserted(parent_node, first, last);
+
+        foreach (const QMailFolder &folder, folders) {
+            const int node = mTree->addFolder(parent_node, folder.id(), folder.displayName());
+            setup(QMailFolderKey::ancestorFolderIds(folder.id()), folder.id(), node, mTree);
+        }
+
+        emit rowsInserted(parent_node, first, last);
+    }
+
+    if (!mTree->uncounted.isEmpty())
+        mLoadTimer.start();
+}
+
+
+void FolderIndex::onFoldersUpdated(const QMailFolderIdList &list)
+{
+    foreach (const QMailFolderId &id, list) {
+
+        const int node = mTree->folderNode(id);
+        if (node < 0)
+            continue;
+
+        const QMailFolder folder(id);
+        if (folder.displayName() != mTree->folder(node).displayName) {
+            mTree->folder(node).displayName = folder.displayName();
+            emit nodeChanged(node);
+        }
+    }
+}
+
+
+void FolderIndex::onFoldersRemoved(const QMailFolderIdList &list)
+{
+    // only topmost removed folders are taken out, the rest goes with them
+    const QSet<QMailFolderId> &removed = list.toSet();
+    QMap<int, QList<int> > folders;
+    foreach (const QMailFolderId &id, removed) {
+
+        const int node = mTree->folderNode(id);
+        if (node < 0)
+            continue;
+
+        bool is_root = true;
+        for (int parent = (*mTree)[node].parent; parent != ROOT && is_root; parent = (*mTree)[parent].parent) {
+            if (Folder == mTree->kind(parent))
+                is_root = !removed.contains(mTree->folder(parent).id);
+        }
+        if (is_root)
+            folders[(*mTree)[node].parent] << (*mTree)[node].row;
+    }
+
+    foreach (int parent_node, folders.keys()) {
+
+        QList<int> indices = folders[parent_node];
+        qSort(indices);
+
+        // consecutive rows at once, from the last ones so the rest stay valid
+        while (!indices.isEmpty()) {
+            const int end = indices.takeLast();
+            int begin = end;
+            while (!indices.isEmpty() && begin - 1 == indices.last())
+                begin = indices.takeLast();
+
+            removeRows(parent_node, begin, end);
+        }
+    }
+}
+
+
+
+void FolderIndex::onMessagesAdded(const QMailMessageIdList &ids)
+{
+    QSet<int> changed;
+    recountFoldersOf(ids, &changed);
+    notify(changed);
+}
+
+
+void FolderIndex::onMessagesUpdated(const QMailMessageIdList &ids)
+{
+    // might have been moved or (un)read without a finer notification
+    QSet<int> changed;
+    recountFoldersOf(ids, &changed);
+    recountLosses(mTree->countedFolders(), &changed);
+    notify(changed);
+}
+
+
+void FolderIndex::onMessagesRemoved(const QMailMessageIdList &ids)
+{
+    Q_UNUSED (ids);  // gone from the store, and so are their folders
+
+    QSet<int> changed;
+    recountLosses(mTree->countedFolders(), &changed);
+    notify(changed);
+}
+
+
+void FolderIndex::onMessageStatusUpdated(const QMailMessageIdList &ids, quint64 status, bool set)
+{
+    Q_UNUSED (set);
+    if (0 == (status & QMailMessage::Read))
+        return;
+
+    QSet<int> changed;
+    recountFoldersOf(ids, &changed);
+    notify(changed);
+}
+
+
+void FolderIndex::onMessagePropertyUpdated(const QMailMessageIdList &ids, const QMailMessageKey::Properties &properties, const QMailMessageMetaData &data)
+{
+    Q_UNUSED (data);
+    if (0 == (properties & (QMailMessageKey::ParentFolderId | QMailMessageKey::Status)))
+        return;
+
+    QSet<int> changed;
+    recountFoldersOf(ids, &changed);
+    if (properties & QMailMessageKey::ParentFolderId)
+        recountLosses(mTree->countedFolders(), &changed);
+    notify(changed);
+}
+
+
+/**
+ * Counts the next chunk of folders not counted yet, in tree order. Message
+ * notifications meanwhile only recount folders counted already, the others
+ * are up to date once their turn comes.
+ */
+void FolderIndex::onLoadTimeout()
+{
+    QSet<int> changed;
+    for (int i = 0; i < LOAD_CHUNK && !mTree->uncounted.isEmpty(); i++) {
+        const int node = mTree->folderNode(mTree->uncounted.takeFirst());
+        if (node >= 0)  // unless removed meanwhile
+            recount(node, &changed);
+    }
+    notify(changed);
+
+    if (mTree->uncounted.isEmpty())
+        mLoadTimer.stop();
+}
+
+
+/// counts the folder's own messages, with two count queries
+void FolderIndex::recount(int node, QSet<int> *changed)
+{
+    QMailStore *store = QMailStore::instance();
+    const QMailMessageKey &key = QMailMessageKey::parentFolderId(mTree->folder(node).id);
+    const int total = store->countMessages(key);
+    const int unread = 0 == total ? 0
+            : store->countMessages(key & QMailMessageKey::status(QMailMessage::Read, QMailDataComparator::Excludes));
+    mTree->setCounts(node, unread, total, changed);
+}
+
+
+/// recounts the folders the messages are in now, with a single metadata query
+void FolderIndex::recountFoldersOf(const QMailMessageIdList &ids, QSet<int> *changed)
+{
+    const QMailMessageMetaDataList &list = QMailStore::instance()->messagesMetaData(
+                QMailMessageKey::id(ids), QMailMessageKey::ParentFolderId, QMailStore::ReturnDistinct);
+
+    foreach (const QMailMessageMetaData &data, list) {
+        const int node = mTree->folderNode(data.parentFolderId());
+        if (node >= 0 && mTree->folder(node).counted)
+            recount(node, changed);
+    }
+}
+
+
+/**
+ * Finds the folders that lost messages, removed or moved away, which the
+ * notifications don't tell: as long as the store's total of a group of the
+ * folders differs from the counted one, the group is halved. One query if
+ * nothing was lost, a few per folder that did lose some.
+ */
+void FolderIndex::recountLosses(const QVector<int> &nodes, QSet<int> *changed)
+{
+    if (nodes.isEmpty())
+        return;
+
+    if (1 == nodes.count()) {
+        recount(nodes.first(), changed);
+        return;
+    }
+
+    QMailFolderIdList ids;
+    int counted = 0;
+    foreach (int node, nodes) {
+        ids << mTree->folder(node).id;
+        counted += mTree->folder(node).own.total;
+    }
+    if (QMailStore::instance()->countMessages(QMailMessageKey::parentFolderId(ids)) == counted)
+        return;
+
+    const int half = nodes.count() / 2;
+    recountLosses(nodes.mid(0, half), changed);
+    recountLosses(nodes.mid(half), changed);
+}
+
+
+void FolderIndex::notify(const QSet<int> &changed)
+{
+    foreach (int node, changed) {
+        if (ROOT != node)
+            emit nodeChanged(node);
+    }
+}
+
+
+
+}  // namespace models
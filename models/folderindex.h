@@ -0,0 +1,107 @@
+#ifndef FOLDERINDEX_H
+#define FOLDERINDEX_H
+
+
+
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+#include <qmfclient/qmailid.h>
+#include <qmfclient/qmailmessagekey.h>
+
+class QMailMessageMetaData;
+
+
+namespace models
+{
+    namespace internal { class NodeTable; }
+
+    /**
+     * Process-wide tree of accounts and their (mail) folders, built once and
+     * kept up to date from the store's notifications. Folder models are views
+     * over it, so none of them queries the store or reacts to its signals on
+     * its own.
+     *
+     * Nodes are referred to by number, ROOT is the invisible root, accounts
+     * are its children. Changes are announced in QAbstractItemModel terms,
+     * with parent nodes instead of indices.
+     *
+     * Unread and total message counts are kept per folder, with a count
+     * query of its own, and rolled up into every node for its subtree. Only
+     * the folders a message notification concerns are recounted. The first
+     * count is not part of startup: it runs from the event loop a chunk of
+     * folders at a time, so counts grow to their values shortly after the
+     * tree is shown.
+     */
+    class FolderIndex : public QObject
+    {
+        Q_OBJECT
+
+        explicit FolderIndex(QObject *parent = 0);
+
+    public:
+        enum Kind { Unused, Root, Account, Folder };
+        enum { ROOT = 0 };
+
+        static FolderIndex * instance();
+        virtual ~FolderIndex();
+
+        Kind kind(int node) const;
+        int parent(int node) const;
+        int row(int node) const;
+        int childCount(int node) const;
+        int child(int node, int row) const;
+
+        /// account name or folder display name
+        QString name(int node) const;
+        QMailAccountId accountId(int node) const;
+        QMailFolderId folderId(int node) const;
+
+        /// -1 if not in the index
+        int accountNode(const QMailAccountId &id) const;
+        int folderNode(const QMailFolderId &id) const;
+        /// the account node the node belongs to, -1 for the root
+        int accountOf(int node) const;
+
+        /// subfolders included
+        int unreadCount(int node) const;
+        int totalCount(int node) const;
+        /// the folder's own messages only, 0 for accounts
+        int ownUnreadCount(int node) const;
+        int ownTotalCount(int node) const;
+
+    signals:
+        void rowsAboutToBeInserted(int parent, int first, int last);
+        void rowsInserted(int parent, int first, int last);
+        void rowsAboutToBeRemoved(int parent, int first, int last);
+        void rowsRemoved(int parent, int first, int last);
+        void nodeChanged(int node);
+
+    private slots:
+        void onAccountsRemoved(const QMailAccountIdList &);
+        void onFoldersAdded(const QMailFolderIdList &);
+        void onFoldersUpdated(const QMailFolderIdList &);
+        void onFoldersRemoved(const QMailFolderIdList &);
+        void onMessagesAdded(const QMailMessageIdList &);
+        void onMessagesUpdated(const QMailMessageIdList &);
+        void onMessagesRemoved(const QMailMessageIdList &);
+        void onMessageStatusUpdated(const QMailMessageIdList &, quint64, bool);
+        void onMessagePropertyUpdated(const QMailMessageIdList &, const QMailMessageKey::Properties &, const QMailMessageMetaData &);
+        void onLoadTimeout();
+
+    private:
+        void removeRows(int parent, int first, int last);
+        void recount(int node, QSet<int> *changed);
+        void recountFoldersOf(const QMailMessageIdList &ids, QSet<int> *changed);
+        void recountLosses(const QVector<int> &nodes, QSet<int> *changed);
+        void notify(const QSet<int> &changed);
+
+        internal::NodeTable *mTree;
+        QTimer mLoadTimer;
+    };
+}
+
+
+#endif // FOLDERINDEX_H
@@ -10,8 +10,9 @@ namespace models
 {
 
 
-namespace internal { struct TreeItem; }
+class FolderIndex;
 
+/// Folders of one account, a view over the account's subtree of the FolderIndex.
 class FolderListModel : public QAbstractItemModel
 {
     Q_OBJECT
@@ -35,13 +36,18 @@ public:
     int columnCount(const QModelIndex &parent = QModelIndex()) const;
 
 private slots:
-    void onAccountsRemoved(const QMailAccountIdList &);
-    void onFoldersAdded(const QMailFolderIdList &);
-    void onFoldersUpdated(const QMailFolderIdList &);
-    void onFoldersRemoved(const QMailFolderIdList &);
+    void onRowsAboutToBeInserted(int parent, int first, int last);
+    void onRowsInserted(int parent);
+    void onRowsAboutToBeRemoved(int parent, int first, int last);
+    void onRowsRemoved(int parent);
+    void onNodeChanged(int node);
 
 private:
-    internal::TreeItem *mRootItem;
+    QModelIndex nodeIndex(int node) const;
+    bool contains(int node) const;
+
+    FolderIndex *mIndex;
+    int mAccountNode;  // -1 if none
 };
 
 
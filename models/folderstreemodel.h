@@ -10,14 +10,17 @@
 
 namespace models
 {
-    namespace internal { struct TreeNode; }
+    class FolderIndex;
 
+    /// All accounts with their folders, a view over the FolderIndex.
     class FoldersTree : public QAbstractItemModel
     {
         Q_OBJECT
     public:
         enum Roles {
-            FolderIdRole = Qt::UserRole
+            FolderIdRole = Qt::UserRole,
+            UnreadCountRole,  // subfolders included
+            TotalCountRole
         };
 
         explicit FoldersTree(QObject *parent = 0);
@@ -34,13 +37,16 @@ namespace models
         int columnCount(const QModelIndex &parent = QModelIndex()) const;
 
     private slots:
-        void onAccountsRemoved(const QMailAccountIdList &);
-        void onFoldersAdded(const QMailFolderIdList &);
-        void onFoldersUpdated(const QMailFolderIdList &);
-        void onFoldersRemoved(const QMailFolderIdList &);
+        void onRowsAboutToBeInserted(int parent, int first, int last);
+        void onRowsInserted();
+        void onRowsAboutToBeRemoved(int parent, int first, int last);
+        void onRowsRemoved();
+        void onNodeChanged(int node);
 
     private:
-        internal::TreeNode *mRootItem;
+        QModelIndex nodeIndex(int node) const;
+
+        FolderIndex *mIndex;
     };
 }
 
@@ -0,0 +1,103 @@
+// Qt
+#include <QAbstractItemView>
+#include <QSettings>
+
+// QMF
+#include <qmfclient/qmailmessagekey.h>
+
+// project
+#include "messagelistmodel.h"
+#include "messagelistcache.h"
+
+
+#define CONNECT(a,b,c,d) if (!QObject::connect(a,b,c,d)) { Q_ASSERT (false); }
+
+
+
+models::MessageListCache::MessageListCache(QAbstractItemView *view)
+  : QObject (view),
+    mView (view)
+{
+    Q_ASSERT (view);
+    mBudget = QSettings().value("message_list_cache_budget", 64 * 1024).toInt();
+}
+
+
+models::MessageListCache::~MessageListCache()
+{
+}
+
+
+models::MessageListModel * models::MessageListCache::show(const QMailFolderId &id)
+{
+    if (!mOrder.isEmpty() && mOrder.last() == id)
+        return mEntries[id].model;
+
+    saveState();
+    if (!mOrder.isEmpty())
+        mEntries[mOrder.last()].model->setActive(false);
+
+    Entry &entry = mEntries[id];
+    if (NULL == entry.model) {
+        entry.model = new MessageListModel(this);
+        entry.model->setKey(id.isValid()
+                            ? QMailMessageKey::parentFolderId(id)
+                            : QMailMessageKey::nonMatchingKey());
+    }
+    mOrder.removeOne(id);
+    mOrder.append(id);
+    entry.model->setActive(true);  // caught up before the view asks for rows
+
+    // the old selection model is not deleted by the view
+    QItemSelectionModel *selection_model = mView->selectionModel();
+    mView->setModel(entry.model);
+    delete selection_model;
+
+    CONNECT (mView->selectionModel(), SIGNAL(currentRowChanged(QModelIndex,QModelIndex)),
+             this, SIGNAL(currentRowChanged(QModelIndex,QModelIndex)));
+
+    restoreState(entry);
+    MessageListModel *model = entry.model;
+    evict();
+    return model;
+}
+
+
+void models::MessageListCache::saveState()
+{
+    if (mOrder.isEmpty())
+        return;
+
+    Entry &entry = mEntries[mOrder.last()];
+    if (mView->model() != entry.model)
+        return;
+
+    entry.topRow = qMax(0, mView->indexAt(QPoint(0, 0)).row());
+    entry.current = entry.model->idFromIndex(mView->currentIndex());
+}
+
+
+void models::MessageListCache::restoreState(const Entry &entry)
+{
+    const QModelIndex &current = entry.model->indexFromId(entry.current);
+    if (current.isValid())
+        mView->setCurrentIndex(current);
+
+    if (entry.topRow < entry.model->rowCount())
+        mView->scrollTo(entry.model->index(entry.topRow, 0), QAbstractItemView::PositionAtTop);
+}
+
+
+/// the shown model is never dropped, whatever it takes
+void models::MessageListCache::evict()
+{
+    qint64 cost = 0;
+    foreach (const Entry &entry, mEntries)
+        cost += entry.model->memoryCost();
+
+    while (cost / 1024 > mBudget && mOrder.size() > 1) {
+        const Entry entry = mEntries.take(mOrder.takeFirst());
+        cost -= entry.model->memoryCost();
+        entry.model->deleteLater();  // may be in the middle of a notification
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef MESSAGELISTCACHE_H
+#define MESSAGELISTCACHE_H
+
+
+#include <QHash>
+#include <QList>
+#include <QModelIndex>
+#include <QObject>
+
+#include <qmfclient/qmailid.h>
+
+class QAbstractItemView;
+
+
+namespace models
+{
+
+
+class MessageListModel;
+
+/**
+ * Recently shown folders' message list models, each with the view's scroll
+ * position and current message, so switching back to a folder is instant.
+ *
+ * Hidden models are inactive: they note the store's changes without querying
+ * it, and catch up when shown again. The least recently shown ones are
+ * dropped when the models together take more than the budget (setting
+ * message_list_cache_budget, in KiB).
+ *
+ * The view gets a new selection model with every model, so the current row
+ * changes are re-emitted from here.
+ */
+class MessageListCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MessageListCache(QAbstractItemView *view);
+    virtual ~MessageListCache();
+
+    /// sets the folder's model on the view, restoring its state
+    MessageListModel * show(const QMailFolderId &id);
+
+signals:
+    void currentRowChanged(const QModelIndex &current, const QModelIndex &previous);
+
+private:
+    struct Entry
+    {
+        MessageListModel *model;
+        int topRow;
+        QMailMessageId current;
+        Entry() : model (NULL), topRow (0) {}
+    };
+
+    void saveState();
+    void restoreState(const Entry &entry);
+    void evict();
+
+    QAbstractItemView *mView;
+    QHash<QMailFolderId, Entry> mEntries;
+    QList<QMailFolderId> mOrder;  // least recently shown first
+    int mBudget;  // KiB
+};
+
+
+}  // namespace models
+
+#endif // MESSAGELISTCACHE_H
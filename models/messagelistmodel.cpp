@@ -1,4 +1,12 @@
 
+// Qt
+#include <QDateTime>
+#include <QSet>
+#include <QSettings>
+
+// QMF
+#include <qmfclient/qmailstore.h>
+
 // project
 #include "serviceactionmanager.h"
 
@@ -7,158 +15,585 @@
 
 
 #define CONNECT(a,b,c,d) if (!QObject::connect(a,b,c,d)) { Q_ASSERT (false); }
-#define DISCONNECT(a,b,c,d) if (!QObject::disconnect(a,b,c,d)) { Q_ASSERT (false); }
+
+
+namespace {
+// rows around the one asked for are loaded along, views ask for them next
+const int METADATA_WINDOW = 64;
+// pages asked for but not fetched yet, older ones are forgotten: the view has
+// scrolled past them, they are asked for again if they come back into view
+const int MAX_PENDING_PAGES = 4;
+// approximate bytes per cached metadata entry, strings included
+const int METADATA_COST = 512;
+// ids noted while hidden, past that the model is reset when shown instead
+const int MAX_PENDING_IDS = 4096;
+}
 
 
 
 
 models::MessageListModel::MessageListModel(QObject* parent)
-  : QMailMessageListModel (parent)
+  : QAbstractListModel (parent),
+    mKey (QMailMessageKey::nonMatchingKey()),
+    mSort (QMailMessageSortKey::timeStamp(Qt::DescendingOrder)),
+    mRowsDirty (false),
+    mActive (true),
+    mResetPending (false)
+{
+    QSettings settings;
+    mPageSize = qMax(METADATA_WINDOW, settings.value("message_list_page_size", 256).toInt());
+    mMetaDataCache.setMaxCost(qMax(METADATA_WINDOW * 2,
+                                   settings.value("message_metadata_cache_size", 4096).toInt()));
+
+    mFetchTimer.setSingleShot(true);
+    mFetchTimer.setInterval(0);
+    CONNECT (&mFetchTimer, SIGNAL(timeout()), this, SLOT(on_fetch()));
+
+    QMailStore *store = QMailStore::instance();
+    CONNECT (store, SIGNAL(messageDataUpdated(QMailMessageMetaDataList)),
+             this, SLOT(on_messageDataUpdated(QMailMessageMetaDataList)));
+    CONNECT (store, SIGNAL(messagePropertyUpdated(QMailMessageIdList,QMailMessageKey::Properties,QMailMessageMetaData)),
+             this, SLOT(on_messagePropertyUpdated(QMailMessageIdList,QMailMessageKey::Properties,QMailMessageMetaData)));
+    CONNECT (store, SIGNAL(messageStatusUpdated(QMailMessageIdList,quint64,bool)),
+             this, SLOT(on_messageStatusUpdated(QMailMessageIdList,quint64,bool)));
+    CONNECT (store, SIGNAL(messagesUpdated(QMailMessageIdList)),
+             this, SLOT(on_messagesUpdated(QMailMessageIdList)));
+    CONNECT (store, SIGNAL(messagesAdded(QMailMessageIdList)),
+             this, SLOT(on_messagesAdded(QMailMessageIdList)));
+    CONNECT (store, SIGNAL(messagesRemoved(QMailMessageIdList)),
+             this, SLOT(on_messagesRemoved(QMailMessageIdList)));
+}
+
+
+void models::MessageListModel::setKey(const QMailMessageKey &key)
+{
+    mKey = key;
+    reset();
+}
+
+
+/**
+ * An inactive model (e.g. a hidden one) does not query the store on its
+ * notifications, it notes the ids instead and catches up, with the same few
+ * queries a single notification takes, once it's active again.
+ */
+void models::MessageListModel::setActive(bool active)
+{
+    if (mActive == active)
+        return;
+
+    mActive = active;
+    if (!mActive)
+        return;
+
+    if (mResetPending) {
+        reset();
+        return;
+    }
+
+    const QMailMessageIdList removed = mPendingRemoved.toList();
+    const QMailMessageIdList updated = mPendingUpdated.toList();
+    mPendingRemoved.clear();
+    mPendingUpdated.clear();
+
+    removeMessages(removed);
+    if (applyUpdates(updated) || !removed.isEmpty())
+        verifyCount();
+}
+
+
+/// notes ids while inactive, up to a point past which a reset is cheaper
+void models::MessageListModel::defer(const QMailMessageIdList &ids, QSet<QMailMessageId> *pending)
+{
+    if (mResetPending)
+        return;
+
+    foreach (const QMailMessageId &id, ids)
+        pending->insert(id);
+
+    if (mPendingRemoved.size() + mPendingUpdated.size() > MAX_PENDING_IDS) {
+        mResetPending = true;
+        mPendingRemoved.clear();
+        mPendingUpdated.clear();
+    }
+}
+
+
+QMailMessageId models::MessageListModel::idFromIndex(const QModelIndex &index) const
+{
+    if (!index.isValid() || index.row() >= mIds.size())
+        return QMailMessageId();
+
+    return mIds[index.row()];
+}
+
+
+QModelIndex models::MessageListModel::indexFromId(const QMailMessageId &id) const
+{
+    if (!id.isValid())
+        return QModelIndex();
+
+    const int id_row = row(id);
+    if (id_row < 0)
+        return QModelIndex();
+
+    return index(id_row, 0);
+}
+
+
+/**
+ * The id's row, -1 if not fetched or not in the list. Fetching adds to the
+ * hash, while inserting or removing rows only marks it dirty: it is rebuilt
+ * on the next miss, once for any number of changes.
+ */
+int models::MessageListModel::row(const QMailMessageId &id) const
 {
-    CONNECT (ServiceActionManager::instance(), SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)),
-             this, SLOT(on_activityChanged(quint64,QMailServiceAction::Activity)));
+    QHash<QMailMessageId, int>::const_iterator it = mRows.constFind(id);
+    if (mRows.constEnd() != it && it.value() < mIds.size() && mIds[it.value()] == id)
+        return it.value();
+
+    if (!mRowsDirty)
+        return -1;
+
+    mRows.clear();
+    mRows.reserve(mIds.size());
+    for (int i = 0; i < mIds.size(); i++) {
+        if (mIds[i].isValid())
+            mRows.insert(mIds[i], i);
+    }
+    mRowsDirty = false;
+
+    return mRows.value(id, -1);
+}
+
+
+qint64 models::MessageListModel::memoryCost() const
+{
+    return qint64(mIds.size()) * sizeof(QMailMessageId)
+         + qint64(mMetaDataCache.size()) * METADATA_COST;
+}
+
+
+int models::MessageListModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return mIds.size();
+}
+
+
+Qt::ItemFlags models::MessageListModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return 0;
+
+    // placeholders can not be acted upon
+    if (!mIds[index.row()].isValid())
+        return Qt::ItemIsEnabled;
+
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
 }
 
 
 QVariant models::MessageListModel::data(const QModelIndex &index, int role) const
 {
-    switch (role) {
+    if (!index.isValid() || index.row() >= mIds.size())
+        return QVariant();
 
-    case ProgressInfoRole: {
+    const QMailMessageId &id = mIds[index.row()];
+    if (!id.isValid()) {
+        requestPage(index.row() / mPageSize);
+        return MessageIdRole == role ? QVariant::fromValue(id) : QVariant();
+    }
 
-        const QMailMessageId &id = idFromIndex(index);
-        Q_ASSERT (id.isValid());
+    switch (role) {
 
-        if (mProgressInfoCache.contains(id))
-            return mProgressInfoCache[id];
+    case MessageIdRole:
+        return QVariant::fromValue(id);
 
-        const QList<quint64> &operations = ServiceActionManager::instance()->operations(id);
-        if (operations.isEmpty())
+    case ProgressInfoRole: {
+        const ProgressInfo &progress = ServiceActionManager::instance()->progress(id);
+        if (progress.isNull())
             return QVariant();
+        return progress;
+    }
 
-        if (mIdsCache.isEmpty())
-            connectCache();
+    case Qt::DisplayRole:
+    case SubjectRole:
+    case SenderRole:
+    case DateRole:
+    case StatusRole: {
 
-        foreach (quint64 serial, operations)
-            mIdsCache[serial] = id;
+        const QMailMessageMetaData *message = metaData(index);
+        if (NULL == message)
+            return QVariant();
 
-        return mProgressInfoCache[id] = ProgressInfo(operations[0]);
+        switch (role) {
+        case Qt::DisplayRole:
+        case SubjectRole:
+            return message->subject();
+        case SenderRole:
+            return message->from().name();
+        case DateRole:
+            return message->date().toLocalTime();
+        default:
+            return message->status();
+        }
     }
 
     default:
-        return QMailMessageListModel::data(index, role);
+        return QVariant();
     }
 }
 
 
-void models::MessageListModel::connectCache() const
+void models::MessageListModel::reset()
 {
-    CONNECT (ServiceActionManager::instance(), SIGNAL(progressChanged(quint64,uint,uint)),
-             this, SLOT(on_progressChanged(quint64,uint,uint)));
-    CONNECT (this, SIGNAL(modelReset()),
-             this, SLOT(on_modelReset()));
-    CONNECT (this, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
-             this, SLOT(on_rowsAboutToBeRemoved(QModelIndex,int,int)));
+    beginResetModel();
+    mResetPending = false;
+    mPendingRemoved.clear();
+    mPendingUpdated.clear();
+    mPendingPages.clear();
+    mFetchTimer.stop();
+    mIds.fill(QMailMessageId(), QMailStore::instance()->countMessages(mKey));
+    ServiceActionManager::instance()->unsubscribe(this);
+    mRows.clear();
+    mRowsDirty = false;
+    endResetModel();
 }
 
 
-void models::MessageListModel::disconnectCache() const
+void models::MessageListModel::requestPage(int page) const
 {
-    DISCONNECT (ServiceActionManager::instance(), SIGNAL(progressChanged(quint64,uint,uint)),
-               this, SLOT(on_progressChanged(quint64,uint,uint)));
-    DISCONNECT (this, SIGNAL(modelReset()),
-               this, SLOT(on_modelReset()));
-    DISCONNECT (this, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
-               this, SLOT(on_rowsAboutToBeRemoved(QModelIndex,int,int)));
+    mPendingPages.removeOne(page);
+    mPendingPages.append(page);
+    while (mPendingPages.size() > MAX_PENDING_PAGES)
+        mPendingPages.removeFirst();
+
+    if (!mFetchTimer.isActive())
+        mFetchTimer.start();
 }
 
 
-void models::MessageListModel::on_modelReset()
+/**
+ * Fetches one page per event loop iteration, the one asked for last, so the
+ * view stays responsive and the rows in view come first while scrolling.
+ */
+void models::MessageListModel::on_fetch()
 {
-    if (!mIdsCache.isEmpty())
-        disconnectCache();
-    mIdsCache.clear();
-    mProgressInfoCache.clear();
+    // pages past the end are left from before a removal
+    int first = mIds.size();
+    while (first >= mIds.size() && !mPendingPages.isEmpty())
+        first = mPendingPages.takeLast() * mPageSize;
+    if (first >= mIds.size())
+        return;
+
+    const QMailMessageIdList &ids = QMailStore::instance()->queryMessages(mKey, mSort, mPageSize, first);
+
+    // the store may have changed since the count, what did not fit is dropped
+    const int last = qMin(mIds.size(), first + ids.size()) - 1;
+    ServiceActionManager *manager = ServiceActionManager::instance();
+    for (int row = first; row <= last; row++) {
+        mIds[row] = ids[row - first];
+        mRows.insert(mIds[row], row);
+        manager->subscribe(mIds[row], this);
+    }
+
+    if (last >= first) {
+        loadMetaData(ids.mid(0, last - first + 1));
+        emit dataChanged(index(first, 0), index(last, 0));
+    }
+
+    if (!mPendingPages.isEmpty())
+        mFetchTimer.start();
+}
+
+
+/**
+ * Progress itself is kept by the manager's registry, rows only need to be
+ * repainted; a batch's rows in one go.
+ */
+void models::MessageListModel::progressInfoChanged(const QMailMessageIdList &ids, const QString &location)
+{
+    Q_UNUSED (location);
+
+    int first = mIds.size();
+    int last = -1;
+    foreach (const QMailMessageId &id, ids) {
+        const int id_row = row(id);
+        if (id_row < 0)
+            continue;
+        first = qMin(first, id_row);
+        last = qMax(last, id_row);
+    }
+
+    if (first <= last)
+        emit dataChanged(index(first, 0), index(last, 0));
 }
 
 
-void models::MessageListModel::on_rowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
+/**
+ * Cached metadata of the row's message. On a miss, the uncached rows of the
+ * window around it are loaded with a single query.
+ */
+const QMailMessageMetaData * models::MessageListModel::metaData(const QModelIndex &index) const
 {
-    for (int i = first; i <= last; i++) {
+    const QMailMessageId &id = idFromIndex(index);
+    if (!id.isValid())
+        return NULL;
+
+    if (QMailMessageMetaData *message = mMetaDataCache.object(id))
+        return message;
+
+    const int first = qMax(0, index.row() - METADATA_WINDOW / 2);
+    const int last = qMin(rowCount() - 1, first + METADATA_WINDOW - 1);
+
+    QMailMessageIdList ids;
+    for (int row = first; row <= last; row++)
+        ids << mIds[row];
+    loadMetaData(ids);
+
+    return mMetaDataCache.object(id);
+}
+
 
-        const QMailMessageId &id = idFromIndex(index(i, 0, parent));
-        Q_ASSERT (id.isValid());
-        quint64 serial = mProgressInfoCache.value(id).serial();
-        mProgressInfoCache.remove(id);
-        mIdsCache.remove(serial);
+/// loads the metadata of the (valid) ids not cached yet, with one query
+void models::MessageListModel::loadMetaData(const QMailMessageIdList &ids) const
+{
+    QMailMessageIdList missing;
+    foreach (const QMailMessageId &id, ids) {
+        if (id.isValid() && !mMetaDataCache.contains(id))
+            missing << id;
     }
+    if (missing.isEmpty())
+        return;
+
+    const QMailMessageKey::Properties properties
+            = QMailMessageKey::Id | QMailMessageKey::Subject | QMailMessageKey::Sender
+            | QMailMessageKey::TimeStamp | QMailMessageKey::Status;
 
-    if (mIdsCache.isEmpty())
-        disconnectCache();
+    foreach (const QMailMessageMetaData &message, QMailStore::instance()->messagesMetaData(QMailMessageKey::id(missing), properties))
+        mMetaDataCache.insert(message.id(), new QMailMessageMetaData(message));
 }
 
 
-void models::MessageListModel::on_progressChanged(quint64 serial, uint value, uint total)
+/**
+ * New messages are placed by their time stamp, as the model sorts by it. The
+ * matching messages down to the oldest one added are queried in the model's
+ * order, at once: an added message's place among them is its row. New mail
+ * being the newest, that's usually a few rows at the top.
+ */
+void models::MessageListModel::insertMessages(const QMailMessageIdList &ids)
 {
-    if (!mIdsCache.contains(serial))
+    QMailStore *store = QMailStore::instance();
+    const QMailMessageKey::Properties properties = QMailMessageKey::Id | QMailMessageKey::TimeStamp;
+    const QMailMessageMetaDataList &messages = store->messagesMetaData(mKey & QMailMessageKey::id(ids), properties);
+
+    // looked up before any insertion, which would make each lookup a rebuild
+    QSet<QMailMessageId> added;
+    QDateTime oldest;
+    foreach (const QMailMessageMetaData &message, messages) {
+        if (row(message.id()) >= 0)
+            continue;
+        added.insert(message.id());
+        const QDateTime &date = message.date().toUTC();
+        if (!oldest.isValid() || date < oldest)
+            oldest = date;
+    }
+    if (added.isEmpty())
         return;
 
-    const QMailMessageId &id = mIdsCache[serial];
-    mProgressInfoCache[id].setInfo(serial, value, total);
+    const QMailMessageIdList &newer
+            = store->queryMessages(mKey & QMailMessageKey::timeStamp(oldest, QMailDataComparator::GreaterThanEqual), mSort);
+
+    // top to bottom, so the rows above are in place already
+    for (int i = 0; i < newer.size() && !added.isEmpty(); i++) {
+        if (!added.remove(newer[i]))
+            continue;
+
+        const int new_row = qMin(mIds.size(), i);
+        beginInsertRows(QModelIndex(), new_row, new_row);
+        mIds.insert(new_row, newer[i]);
+        ServiceActionManager::instance()->subscribe(newer[i], this);
+        mRowsDirty = true;
+        endInsertRows();
+    }
+}
+
+
+void models::MessageListModel::removeMessages(const QMailMessageIdList &ids)
+{
+    QList<int> rows;
+    foreach (const QMailMessageId &id, ids) {
+        const int id_row = row(id);
+        if (id_row >= 0) {
+            rows << id_row;
+            ServiceActionManager::instance()->unsubscribe(id, this);
+        }
+    }
+    qSort(rows);
+
+    // back to front, a range of consecutive rows at a time
+    while (!rows.isEmpty()) {
+        const int last = rows.takeLast();
+        int first = last;
+        while (!rows.isEmpty() && first - 1 == rows.last())
+            first = rows.takeLast();
+
+        beginRemoveRows(QModelIndex(), first, last);
+        mIds.remove(first, last - first + 1);
+        mRowsDirty = true;
+        endRemoveRows();
+    }
+}
+
+
+void models::MessageListModel::updated(const QMailMessageId &id)
+{
+    if (!mMetaDataCache.remove(id))
+        return;  // nothing shown of it yet
 
     const QModelIndex &index = indexFromId(id);
-    emit dataChanged(index, index);
+    if (index.isValid())
+        emit dataChanged(index, index);
 }
 
 
-void models::MessageListModel::on_activityChanged(quint64 serial, QMailServiceAction::Activity activity)
+void models::MessageListModel::on_messageDataUpdated(const QMailMessageMetaDataList &list)
 {
-    switch (activity) {
+    foreach (const QMailMessageMetaData &message, list)
+        updated(message.id());
+}
 
-    case QMailServiceAction::Pending: {
 
-        if (mIdsCache.contains(serial))
-            return;
+void models::MessageListModel::on_messagePropertyUpdated(const QMailMessageIdList &ids, const QMailMessageKey::Properties &properties, const QMailMessageMetaData &data)
+{
+    Q_UNUSED (properties);
+    Q_UNUSED (data);
 
-        /// FIXME: how to get message_id from serial?
-        const ServiceActionManager::OperationInfo *operation = ServiceActionManager::instance()->operationInfo(serial);
-        if (!operation)
-            return;
+    foreach (const QMailMessageId &id, ids)
+        updated(id);
+}
 
-        const auto messageIds = operation->messageIds();
-        if (messageIds.isEmpty())
-            return;
 
-        const QMailMessageId &id = messageIds.first();  /// FIXME!!!!!
-        if (!id.isValid())
-            return;
+void models::MessageListModel::on_messageStatusUpdated(const QMailMessageIdList &ids, quint64 status, bool set)
+{
+    foreach (const QMailMessageId &id, ids) {
+        QMailMessageMetaData *message = mMetaDataCache.object(id);
+        if (NULL == message)
+            continue;
 
+        message->setStatus(status, set);
         const QModelIndex &index = indexFromId(id);
-        if (!index.isValid())
-            return;
+        if (index.isValid())
+            emit dataChanged(index, index);
+    }
+}
 
-        connectCache();
-        mIdsCache[serial] = id;
-        emit dataChanged(index, index);
-    }   break;
 
-    case QMailServiceAction::Successful:
-    case QMailServiceAction::Failed: {
+/**
+ * Messages may have moved into or out of the list. Fetched rows are known
+ * to have matched before the update, placeholders are not: a matching id
+ * without a row is either new to the list or not fetched yet. The count
+ * tells which, when all of them are one or the other; mixed (or unknown
+ * removals along with them), the model is reset.
+ */
+void models::MessageListModel::on_messagesUpdated(const QMailMessageIdList &ids)
+{
+    foreach (const QMailMessageId &id, ids)
+        updated(id);
 
-        if (!mIdsCache.contains(serial))
-            return;
+    if (!mActive) {
+        defer(ids, &mPendingUpdated);
+        return;
+    }
 
-        mProgressInfoCache.remove(mIdsCache[serial]);
-        mIdsCache.remove(serial);
+    if (applyUpdates(ids))
+        verifyCount();
+}
 
-        if (mIdsCache.isEmpty())
-            disconnectCache();
 
-        const QModelIndex &index = indexFromId(mIdsCache[serial]);
-        emit dataChanged(index, index);
-    }   break;
+/**
+ * Returns whether the count is still to be verified: not after a reset or an
+ * insertion, which counted already, nor when no row came or went, as with
+ * status changes, the usual updates.
+ */
+bool models::MessageListModel::applyUpdates(const QMailMessageIdList &ids)
+{
+    if (ids.isEmpty())
+        return false;
+
+    const QSet<QMailMessageId> &matching
+            = QMailStore::instance()->queryMessages(mKey & QMailMessageKey::id(ids)).toSet();
+    QMailMessageIdList gone;
+    QMailMessageIdList unknown;  // matching, without a row
+    bool unknown_gone = false;  // not matching, without a row, may have been a placeholder
+    foreach (const QMailMessageId &id, ids) {
+        const bool fetched = row(id) >= 0;
+        if (!matching.contains(id)) {
+            if (fetched)
+                gone << id;
+            else
+                unknown_gone = true;
+        }
+        else if (!fetched) {
+            unknown << id;
+        }
+    }
+    removeMessages(gone);
+
+    if (!unknown.isEmpty()) {
+        const int added = QMailStore::instance()->countMessages(mKey) - mIds.size();
+        if (unknown.size() == added) {
+            insertMessages(unknown);
+        }
+        else if (0 != added || unknown_gone) {
+            reset();
+        }
+        return false;
+    }
 
-    default:
+    return !gone.isEmpty() || unknown_gone;
+}
+
+
+void models::MessageListModel::on_messagesAdded(const QMailMessageIdList &ids)
+{
+    if (!mActive) {
+        defer(ids, &mPendingUpdated);  // caught up with as if they moved in
         return;
     }
+
+    insertMessages(ids);
+    verifyCount();
+}
+
+
+void models::MessageListModel::on_messagesRemoved(const QMailMessageIdList &ids)
+{
+    foreach (const QMailMessageId &id, ids)
+        mMetaDataCache.remove(id);
+
+    if (!mActive) {
+        foreach (const QMailMessageId &id, ids)
+            mPendingUpdated.remove(id);
+        defer(ids, &mPendingRemoved);
+        return;
+    }
+
+    removeMessages(ids);
+    verifyCount();
+}
+
+
+/**
+ * Changes to placeholder rows can not be applied in place, neither can the
+ * ones the count already had when the notification came. Both show up as a
+ * count mismatch, and are resolved with a reset.
+ */
+void models::MessageListModel::verifyCount()
+{
+    if (mIds.size() != QMailStore::instance()->countMessages(mKey))
+        reset();
 }
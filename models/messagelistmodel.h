@@ -2,9 +2,19 @@
 #define MESSAGELISTMODEL_H
 
 
-#include <qmfclient/qmailmessagelistmodel.h>  // QMailMessageListModel
+#include <QAbstractListModel>
+#include <QCache>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+#include <qmfclient/qmailmessage.h>  // QMailMessageMetaData
+#include <qmfclient/qmailmessagekey.h>  // QMailMessageKey
+#include <qmfclient/qmailmessagemodelbase.h>  // QMailMessageModelBase
+#include <qmfclient/qmailmessagesortkey.h>  // QMailMessageSortKey
 #include <qmfclient/qmailserviceaction.h>  // QMailServiceAction
 
+#include "serviceactionmanager.h"
 #include "progressinfo.h"
 
 
@@ -12,45 +22,99 @@
 namespace models {
 
 /**
- MessageListModel provides support for accessing progress info
+ MessageListModel lists the messages matching a key, newest first, without
+ ever materialising the whole id list: large folders open at once
 
- # listen service action manager for progress and update view if needed
+ # only the count is queried up front. Ids are fetched a page at a time, from
+   the event loop, for the pages views ask for; rows of pages not fetched yet
+   are placeholders (invalid id, no data)
 
- # for that it have to maintain few caches:
+ # added, moved and removed messages are applied in place where possible,
+   otherwise the model is reset. An inactive model (hidden, in a cache) only
+   notes their ids, and applies them once it's active again
 
-   * service action operations (serials) mapped to ids.
-     this is for filtering progress emitted by service action manager
+ # rows of ids are looked up in a hash, rebuilt once after rows were
+   inserted or removed, so progress updates do not scan the list
 
-   * ids mapped to progress info
+ # metadata is loaded for a window of rows at once, kept in a LRU cache and
+   invalidated by the store's update notifications
+
+ # progress info is read from the service action manager's registry; the
+   model subscribes to the messages of fetched rows, only to repaint them
 
 */
 
-class MessageListModel : public QMailMessageListModel
+class MessageListModel : public QAbstractListModel, public ServiceActionManager::Subscriber
 {
     Q_OBJECT
 
 public:
     enum Roles
     {
-        ProgressInfoRole = Qt::UserRole + 32
+        MessageIdRole = QMailMessageModelBase::MessageIdRole,  // invalid for placeholders
+        ProgressInfoRole = Qt::UserRole + 32,
+        SubjectRole,
+        SenderRole,  // sender's name
+        DateRole,  // local time
+        StatusRole  // QMailMessage status flags
     };
 
     MessageListModel(QObject* parent = 0);
+
+    QMailMessageKey key() const { return mKey; }
+    void setKey(const QMailMessageKey &key);
+    bool isActive() const { return mActive; }
+    void setActive(bool active);
+    bool isEmpty() const { return mIds.isEmpty(); }
+    /// rough size in bytes, for budgeting cached models
+    qint64 memoryCost() const;
+
+    QMailMessageId idFromIndex(const QModelIndex &index) const;
+    /// invalid if the message is not in the list, or not fetched yet
+    QModelIndex indexFromId(const QMailMessageId &id) const;
+
+    virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
     virtual QVariant data(const QModelIndex& index, int role=Qt::DisplayRole) const;
+    virtual Qt::ItemFlags flags(const QModelIndex &index) const;
 
-private:
-    void connectCache() const;
-    void disconnectCache() const;
+    virtual void progressInfoChanged(const QMailMessageIdList &ids, const QString &location);
 
 private slots:
-    void on_modelReset();
-    void on_rowsAboutToBeRemoved(const QModelIndex &parent, int first, int last);
-    void on_progressChanged(quint64 serial, uint value, uint total);
-    void on_activityChanged(quint64, QMailServiceAction::Activity);
+    void on_messageDataUpdated(const QMailMessageMetaDataList &list);
+    void on_messagePropertyUpdated(const QMailMessageIdList &ids, const QMailMessageKey::Properties &properties, const QMailMessageMetaData &data);
+    void on_messageStatusUpdated(const QMailMessageIdList &ids, quint64 status, bool set);
+    void on_messagesUpdated(const QMailMessageIdList &ids);
+    void on_messagesAdded(const QMailMessageIdList &ids);
+    void on_messagesRemoved(const QMailMessageIdList &ids);
+    void on_fetch();
 
 private:
-    mutable QHash<QMailMessageId, ProgressInfo> mProgressInfoCache;
-    mutable QHash<quint64, QMailMessageId> mIdsCache;
+    void reset();
+    void requestPage(int page) const;
+    void insertMessages(const QMailMessageIdList &ids);
+    void removeMessages(const QMailMessageIdList &ids);
+    bool applyUpdates(const QMailMessageIdList &ids);
+    void defer(const QMailMessageIdList &ids, QSet<QMailMessageId> *pending);
+    void verifyCount();
+    int row(const QMailMessageId &id) const;
+    void loadMetaData(const QMailMessageIdList &ids) const;
+    const QMailMessageMetaData * metaData(const QModelIndex &index) const;
+    void updated(const QMailMessageId &id);
+
+    QMailMessageKey mKey;
+    QMailMessageSortKey mSort;
+    QVector<QMailMessageId> mIds;  // a row per matching message, invalid until fetched
+    mutable QHash<QMailMessageId, int> mRows;  // fetched ids' rows, see row()
+    mutable bool mRowsDirty;
+    int mPageSize;
+    mutable QList<int> mPendingPages;  // most recently asked for last
+    mutable QTimer mFetchTimer;
+    bool mActive;
+    bool mResetPending;  // too much changed while inactive
+    QSet<QMailMessageId> mPendingRemoved;  // noted while inactive
+    QSet<QMailMessageId> mPendingUpdated;  // added ones too
+
+    mutable QCache<QMailMessageId, QMailMessageMetaData> mMetaDataCache;
 };
 
 
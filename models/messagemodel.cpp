@@ -1,4 +1,6 @@
 #include <qdebug.h>
+#include <QFileInfo>
+#include <QtConcurrentRun>
 #include <qmfclient/qmailstore.h>
 
 #include "debug.h"
@@ -9,10 +11,58 @@
 #define CONNECT(a,b,c,d) if (!QObject::connect(a,b,c,d)) { Q_ASSERT (false); }
 
 
+namespace {
+
+/**
+ * The file the store's default content manager keeps the whole message in,
+ * empty if the message is kept some other way. Parts retrieved on their own
+ * are stored next to it, in a "-parts" directory, and only the store puts
+ * them back together.
+ */
+QString content_file(const QMailMessageMetaData &metadata)
+{
+    if (metadata.contentScheme() != "qmfstoragemanager")
+        return QString();
+
+    const QFileInfo file (metadata.contentIdentifier());
+    if (!file.isAbsolute() || !file.exists() || QFileInfo(file.filePath() + "-parts").exists())
+        return QString();
+
+    return file.filePath();
+}
+
+
+/**
+ * Runs on a worker thread, the store is not used: parses the message file,
+ * attachments included, and keeps only what is viewed. The metadata the
+ * viewer relies on (id of the message and of its parts, status) is the one
+ * read on the UI thread.
+ */
+models::ViewedMessage parse_message(const QString &path, const QMailMessageMetaData &metadata)
+{
+    QMailMessage message = QMailMessage::fromRfc2822File(path);
+    message.setId(metadata.id());
+    message.setStatus(metadata.status());
+    message.setParentAccountId(metadata.parentAccountId());
+    message.setParentFolderId(metadata.parentFolderId());
+    return models::ViewedMessage(message);
+}
+
+}
+
+
 
 models::MessageModel::MessageModel(QObject *parent)
-  : QObject (parent)
+  : QObject (parent),
+    mGeneration (0),
+    mLoadGeneration (0),
+    mLoading (false)
 {
+    mLoadTimer.setSingleShot(true);
+    mLoadTimer.setInterval(0);
+    CONNECT (&mLoadTimer, SIGNAL(timeout()), this, SLOT(on_load()));
+    CONNECT (&mLoader, SIGNAL(finished()), this, SLOT(on_loadFinished()));
+
     CONNECT (QMailStore::instance(), SIGNAL(messageContentsModified(QMailMessageIdList)),
                              this, SLOT(on_messageContentsModified(QMailMessageIdList)));
     CONNECT (QMailStore::instance(), SIGNAL(messageDataUpdated(QMailMessageMetaDataList)),
@@ -23,20 +73,85 @@ models::MessageModel::MessageModel(QObject *parent)
                              this, SLOT(on_messageStatusUpdated(QMailMessageIdList,quint64,bool)));
     CONNECT (QMailStore::instance(), SIGNAL(messagesUpdated(QMailMessageIdList)),
                              this, SLOT(on_messagesUpdated(QMailMessageIdList)));
-    CONNECT (ServiceActionManager::instance(), SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)),
-                             this, SLOT(on_activityChanged(quint64,QMailServiceAction::Activity)));
 }
 
 
 void models::MessageModel::setMessageId(const QMailMessageId &id)
 {
-    mMessage = QMailMessage(id);
-    mOperations = ServiceActionManager::instance()->operations(mMessage.id());
+    ServiceActionManager *manager = ServiceActionManager::instance();
+    if (mMessageId.isValid())
+        manager->unsubscribe(mMessageId, this);
+
+    mMessageId = id;
+    mMetaData = id.isValid() ? QMailMessageMetaData(id) : QMailMessageMetaData();
+    mMessage = ViewedMessage();
+    mOperations = manager->operations(id);
+    mGeneration++;
+    mLoading = id.isValid();
+    if (id.isValid()) {
+        manager->subscribe(id, this);
+        mLoadTimer.start();  // a pending load is for this id now
+    }
+    else {
+        mLoadTimer.stop();
+    }
+
     emit modelReset();
     emit updated(); /// TODO: emit only modelReset
 }
 
 
+/**
+ * Starts the load once the events queued meanwhile are processed, so ids set
+ * in a row (key repeat) cost a metadata read each, not a load each. Only one
+ * load runs at a time.
+ */
+void models::MessageModel::on_load()
+{
+    if (!mMessageId.isValid() || mLoader.isRunning())
+        return;  // a running one is followed by another if it's stale
+
+    mLoadGeneration = mGeneration;
+    const QString &path = content_file(mMetaData);
+    if (path.isEmpty()) {
+        // only the store can read it back, on this thread then
+        _loaded(ViewedMessage(QMailMessage(mMessageId)));
+        return;
+    }
+
+    mLoader.setFuture(QtConcurrent::run(parse_message, path, mMetaData));
+}
+
+
+void models::MessageModel::on_loadFinished()
+{
+    if (mLoadGeneration != mGeneration) {
+        // selection moved on, or the message changed while loading
+        if (mMessageId.isValid())
+            mLoadTimer.start();
+        return;
+    }
+
+    _loaded(mLoader.result());
+}
+
+
+void models::MessageModel::_loaded(const ViewedMessage &message)
+{
+    mMessage = message;
+
+    if (mLoading) {
+        mLoading = false;
+        emit modelReset();
+        emit updated();
+        emit loaded();
+    }
+    else {
+        emit updated();
+    }
+}
+
+
 void models::MessageModel::on_messageContentsModified(const QMailMessageIdList &ids)
 {
     Q_UNUSED (ids);
@@ -77,34 +192,32 @@ void models::MessageModel::on_messageStatusUpdated(const QMailMessageIdList &ids
 
 void models::MessageModel::on_messagesUpdated(const QMailMessageIdList &ids)
 {
-    if (mMessage.id().isValid() && ids.contains(mMessage.id())) {
-        mMessage = QMailMessage(mMessage.id());
-        emit updated();
+    if (mMessageId.isValid() && ids.contains(mMessageId)) {
+        // the current message stays shown until the reload is done
+        mMetaData = QMailMessageMetaData(mMessageId);
+        mGeneration++;
+        mLoadTimer.start();
     }
 }
 
 
-void models::MessageModel::on_activityChanged(quint64 serial, QMailServiceAction::Activity activity)
+void models::MessageModel::operationActivityChanged(quint64 serial, QMailServiceAction::Activity activity)
 {
-    if (!mMessage.id().isValid())
-        return;
-
     switch (activity) {
 
     case QMailServiceAction::Pending: {
         // operation added, remembering
-        const auto &operations = ServiceActionManager::instance()->operations(mMessage.id());
-        if (!operations.contains(serial))
+        if (mOperations.contains(serial))
             return;
 
-        mOperations = operations;
+        mOperations << serial;
         emit updated();
     }   break;
 
     case QMailServiceAction::Successful:
     case QMailServiceAction::Failed:
         // operation removed
-        if (!mOperations.contains(serial))
+        if (!mOperations.removeOne(serial))
             return;
 
         emit updated();
@@ -3,28 +3,54 @@
 
 
 
+#include <QFutureWatcher>
 #include <QObject>
+#include <QTimer>
 
 #include <qmfclient/qmailmessage.h>
 #include <qmfclient/qmailmessagekey.h>
 #include <qmfclient/qmailserviceaction.h>
 
+#include "serviceactionmanager.h"
+#include "viewedmessage.h"
+
 
 namespace models {
 
 
-class MessageModel : public QObject
+/**
+ * The message being viewed, loaded in two steps as the store may only be used
+ * from the UI thread: setMessageId() reads just the metadata, the message
+ * itself is parsed (and reparsed on updates) on a worker thread, from the
+ * file the store keeps its content in. While it loads, message() is empty and
+ * isLoading() is true. Ids set meanwhile, e.g. while scrolling through a
+ * list, replace each other: only the latest is loaded, and a load finishing
+ * after the selection moved on is dropped.
+ *
+ * Only headers, body and attachment descriptors are kept (see ViewedMessage),
+ * attachment content is loaded with ViewedMessage::loadPart() when needed.
+ */
+class MessageModel : public QObject, public ServiceActionManager::Subscriber
 {
     Q_OBJECT
 public:
     explicit MessageModel(QObject *parent = 0);
     void setMessageId(const QMailMessageId &id);
-    const QMailMessage & message() const { return mMessage; }
-    QMailMessage & message() { return mMessage; }
+    /// the message asked for, loaded or not
+    QMailMessageId messageId() const { return mMessageId; }
+    bool isLoading() const { return mLoading; }
+    /// available right away, while the message loads
+    const QMailMessageMetaData & metaData() const { return mMetaData; }
+    /// attachment parts have no content here
+    const QMailMessage & message() const { return mMessage.message(); }
+    const QList<ViewedMessage::Attachment> & attachments() const { return mMessage.attachments(); }
+
+    virtual void operationActivityChanged(quint64 serial, QMailServiceAction::Activity activity);
 
 signals:
     void modelReset();
     void updated();
+    void loaded();  // the message set last is available
 
 private slots:
     void on_messageContentsModified(const QMailMessageIdList &ids);
@@ -32,11 +58,21 @@ private slots:
     void on_messagePropertyUpdated(const QMailMessageIdList &ids, const QMailMessageKey::Properties &properties, const QMailMessageMetaData &data);
     void on_messageStatusUpdated(const QMailMessageIdList &ids, quint64, bool);
     void on_messagesUpdated(const QMailMessageIdList &ids);
-    void on_activityChanged(quint64 serial, QMailServiceAction::Activity a);
+    void on_load();
+    void on_loadFinished();
 
 private:
-    QMailMessage mMessage;
+    void _loaded(const ViewedMessage &message);
+
+    QMailMessageId mMessageId;
+    QMailMessageMetaData mMetaData;
+    ViewedMessage mMessage;
     QList<quint64> mOperations;
+    QTimer mLoadTimer;
+    QFutureWatcher<ViewedMessage> mLoader;
+    uint mGeneration;  // of the message asked for, bumped on every change
+    uint mLoadGeneration;  // of the one being loaded
+    bool mLoading;
 };
 
 
@@ -0,0 +1,84 @@
+#include "progressinfo.h"
+
+
+
+namespace {
+
+/**
+ * Fixed size blocks carved out of chunks and recycled through a free list,
+ * chunks are never returned. Progress info lives on the GUI thread only, so
+ * there is no locking.
+ */
+class Pool
+{
+public:
+    explicit Pool(size_t block_size)
+      : mBlockSize (align(qMax(block_size, sizeof(Block)))), mFree (NULL) {}
+
+    void * allocate()
+    {
+        if (NULL == mFree)
+            grow();
+
+        Block *block = mFree;
+        mFree = block->next;
+        return block;
+    }
+
+    void release(void *p)
+    {
+        Block *block = static_cast<Block *>(p);
+        block->next = mFree;
+        mFree = block;
+    }
+
+private:
+    enum { BLOCKS_PER_CHUNK = 256 };
+
+    struct Block { Block *next; };
+
+    // blocks follow each other, each has to be aligned for any member
+    static size_t align(size_t size) { return (size + sizeof(quint64) - 1) & ~(sizeof(quint64) - 1); }
+
+    void grow()
+    {
+        char *chunk = new char[mBlockSize * BLOCKS_PER_CHUNK];
+        for (int i = BLOCKS_PER_CHUNK - 1; i >= 0; i--)
+            release(chunk + i * mBlockSize);
+    }
+
+    const size_t mBlockSize;
+    Block *mFree;
+};
+
+}
+
+
+
+namespace models {
+
+
+namespace {
+Pool & dataPool(size_t size)
+{
+    static Pool pool(size);
+    return pool;
+}
+}
+
+
+void * ProgressInfo::Data::operator new(size_t size)
+{
+    Q_ASSERT (sizeof(Data) == size);
+    return dataPool(size).allocate();
+}
+
+
+void ProgressInfo::Data::operator delete(void *p)
+{
+    if (p)
+        dataPool(sizeof(Data)).release(p);
+}
+
+
+}  // namespace models
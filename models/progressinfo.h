@@ -11,11 +11,17 @@
 namespace models {
 
 
+/**
+ * Progress of an operation (or a few combined), as kept by the progress
+ * registry of ServiceActionManager. A null one means no operation at all, a
+ * value of -1 means no progress reported yet.
+ */
 class ProgressInfo
 {
 //    Q_GADGET
 public:
-    ProgressInfo(quint64 serial=0) : d (new ProgressInfo::Data(serial, -1,1)) {}
+    ProgressInfo() {}
+    explicit ProgressInfo(quint64 serial, int value=-1, int total=1) : d (new ProgressInfo::Data(serial, value, total)) {}
     ProgressInfo(const ProgressInfo &other) : d (other.d.data()) {}
     inline ~ProgressInfo() {}  // not really empty
 
@@ -25,20 +31,26 @@ public:
     bool operator==(const ProgressInfo &) const = delete;
     bool operator!=(const ProgressInfo &) const = delete;
 
-    quint64 serial() const { return d->serial; }
-    int value() const { return d->value; }
-    int total() const { return d->total; }
+    bool isNull() const { return !d; }
+    quint64 serial() const { return d ? d->serial : 0; }
+    int value() const { return d ? d->value : -1; }
+    int total() const { return d ? d->total : 1; }
     void setInfo(quint64 serial, int value=-1, int total=1)
     {
-        detach();
-        d->serial = serial;
-        d->value = value;
-        d->total = total;
+        if (!d)
+            d = new Data(serial, value, total);
+        else {
+            detach();
+            d->serial = serial;
+            d->value = value;
+            d->total = total;
+        }
     }
 
 private:
     inline void detach() { if (d->ref > 1) d.detach(); }
 
+    /// allocated from a pool, they come and go with every progress update
     struct Data
     {
         QAtomicInt ref;
@@ -46,7 +58,11 @@ private:
         int value;
         int total;
 
-        Data(quint64 s, int v, int t) : serial(s), value(v), total(t) {}
+        Data(quint64 s, int v, int t) : ref(0), serial(s), value(v), total(t) {}
+        Data(const Data &other) : ref(0), serial(other.serial), value(other.value), total(other.total) {}
+
+        static void * operator new(size_t size);
+        static void operator delete(void *p);
     private:
         Data &operator=(const Data &) = delete;
     };
@@ -0,0 +1,45 @@
+// project
+#include "utils.h"
+#include "viewedmessage.h"
+
+
+
+models::ViewedMessage::ViewedMessage(const QMailMessage &message)
+  : mMessage (message)
+{
+    // the body part and the parts inside it (e.g. inline images) are kept
+    QString body_location;
+    if (const QMailMessagePart *body = dynamic_cast<const QMailMessagePart *>(find::messageBody(message)))
+        body_location = body->location().toString(true);
+    const QString &body_prefix = body_location + ".";
+
+    foreach (const QMailMessagePart::Location &location, message.findAttachmentLocations()) {
+
+        const QMailMessagePart &part = message.partAt(location);
+
+        Attachment attachment;
+        attachment.location = location;
+        attachment.displayName = part.displayName();
+        attachment.mimeType = QString(part.contentType().content());
+        attachment.downloaded = part.contentAvailable();
+        attachment.size = part.contentDisposition().size();
+        // if size is unknown, try finding out attachment's body size
+        if (-1 == attachment.size && part.contentAvailable())
+            attachment.size = part.hasBody() ? part.body().length() : 0;
+        mAttachments << attachment;
+
+        const QString &location_str = location.toString(true);
+        if (body_location.isEmpty() || (location_str != body_location && !location_str.startsWith(body_prefix)))
+            mMessage.partAt(location).setBody(QMailMessageBody());  // the copy detaches
+    }
+}
+
+
+QMailMessagePart models::ViewedMessage::loadPart(const QMailMessagePart::Location &location)
+{
+    const QMailMessage message(location.containingMessageId());
+    if (!message.contains(location))
+        return QMailMessagePart();
+
+    return message.partAt(location);
+}
@@ -0,0 +1,54 @@
+#ifndef VIEWEDMESSAGE_H
+#define VIEWEDMESSAGE_H
+
+
+
+#include <QList>
+#include <QString>
+
+#include <qmfclient/qmailmessage.h>
+
+
+namespace models {
+
+
+/**
+ * What the message viewer keeps of a message: the headers, the body with its
+ * content, and descriptors of the attachments. Attachment content is dropped
+ * right after loading; loadPart() reads a part from the store when it is
+ * actually needed. So memory held for the viewed message does not depend on
+ * the size of its attachments.
+ */
+class ViewedMessage
+{
+public:
+    struct Attachment
+    {
+        QMailMessagePart::Location location;
+        QString displayName;
+        QString mimeType;
+        int size;  // -1 if unknown
+        bool downloaded;
+    };
+
+    ViewedMessage() {}
+    /// strips the attachments' content
+    explicit ViewedMessage(const QMailMessage &message);
+
+    /// headers and body; the attachment parts are there, but with no content
+    const QMailMessage & message() const { return mMessage; }
+    const QList<Attachment> & attachments() const { return mAttachments; }
+
+    /// the part with its content, loaded from the store and not kept
+    static QMailMessagePart loadPart(const QMailMessagePart::Location &location);
+
+private:
+    QMailMessage mMessage;
+    QList<Attachment> mAttachments;
+};
+
+
+
+}  // namespace models
+
+#endif // VIEWEDMESSAGE_H
@@ -1,44 +1,386 @@
-#include <qmfclient/qmailmessage.h>
+#include <QSettings>
+#include <QSet>
+#include <QVector>
+#include <QTime>
 
-#include <qmfclient/qmailmessageserver.h>
+#include <algorithm>
 
+#include <qmfclient/qmailmessage.h>
 
 #include "debug.h"
+#include "messageserver.h"
 #include "serviceactionmanager.h"
 
+#ifdef F2_FAKE_MESSAGESERVER
+#  include "fakemessageserver.h"
+#endif
+
 #define CONNECT(a,b,c,d) if (!QObject::connect(a,b,c,d)) { Q_ASSERT (false); }
 
 
 
+/** An operation's own serial or a request folded into it, with its keys. */
+struct OperationTarget
+{
+    quint64 serial;
+    QMailMessageIdList ids;
+    QString location;
+};
+
+
+
+/**
+ * A request folded into another operation: a batch one, or an identical one
+ * queued or running already. It keeps its own serial, message ids and part
+ * location, while the work is done by the target operation.
+ */
+class OperationAlias : public ServiceActionManager::OperationInfo
+{
+public:
+    OperationAlias(quint64 alias_serial, const QMailMessageIdList &message_ids, OperationContext *operation)
+      : serial (alias_serial), ids (message_ids), target (operation)
+    {}
+
+    quint64 serial;
+    QMailMessageIdList ids;
+    QMailMessagePart::Location location;
+    QString locationKey;
+    OperationContext *target;
+    QString key;
+
+    virtual QMailMessageIdList messageIds() const { return ids; }
+    virtual QMailMessagePart::Location messagePartLocation() const { return location; }
+};
+
+
+
 class OperationContext : public ServiceActionManager::OperationInfo
 {
 public:
-    enum Priority {
-        Low = 0,
-        Normal,
-        High
-    };
+    typedef ServiceActionManager::Priority Priority;
     virtual ~OperationContext() {}
-    virtual void exec(QMailMessageServer *server) = 0;
-    void cancelOperation(QMailMessageServer *server) { server->cancelTransfer(serial); }
+    virtual void exec(MessageServer *server) = 0;
+    /// kind of the request, operation stats are collected per type
+    virtual const char * type() const = 0;
+    void cancelOperation(MessageServer *server) { server->cancelTransfer(serial); }
     quint64 serial;
     QMailServiceAction::Status status;
     Priority priority;
-    OperationContext() : serial (0), priority (Normal) {}
+    QMailAccountId accountId;
+    OperationLane *lane;
+    bool preempted;  // cancelled to let a higher priority operation run, will be restarted
+    bool detached;  // own serial was cancelled, runs only for the folded requests
+    bool cancelled;  // forgotten, disposed of once no queue entry refers to it
+    uint preemptions;
+    uint attempts;  // failed attempts retried so far
+    qint64 retryAt;  // waiting to be retried, 0 if not
+    qint64 enqueuedAt;
+    qint64 deadline;  // queue order, enqueuedAt plus the deadline of the priority class
+    qint64 queuedAt;  // (re)entered the queue last
+    qint64 startedAt;  // latest attempt started, -1 if none
+    qint64 waited;  // in the queue, over all attempts
+    qint64 executed;  // running, over all attempts
+    uint generation;  // queue entries of older generations are stale
+    uint queued;  // number of queue entries referring to the operation
+    uint progressValue;
+    uint progressTotal;
+    QList<OperationAlias *> aliases;
+    QString key;
+    QString locationKey;
+    OperationContext()
+      : serial (0), priority (ServiceActionManager::Normal), lane (NULL),
+        preempted (false), detached (false), cancelled (false), preemptions (0),
+        attempts (0), retryAt (0), enqueuedAt (0), deadline (0), queuedAt (0), startedAt (-1),
+        waited (0), executed (0), generation (0), queued (0), progressValue (0), progressTotal (0) {}
 //    bool operator==(const quint64 serial) const { return serial == serial ? true : false; }
     virtual QMailMessageIdList messageIds() const { return QMailMessageIdList(); }
     virtual QMailMessagePart::Location messagePartLocation() const { return QMailMessagePart::Location(); }
+
+    /// interrupted before, whatever was downloaded so far is in the store
+    bool restarted() const { return preemptions > 0 || attempts > 0; }
+
+    /// identical requests have equal keys, empty key means "never merge"
+    virtual QString coalescingKey() const { return QString(); }
+    /// requests with equal keys could be folded into a single server call
+    virtual QString batchKey() const { return QString(); }
+
+    /// serials, message ids and part locations to report the operation's activity and progress to
+    QList<OperationTarget> targets() const
+    {
+        QList<OperationTarget> res;
+        if (!detached) {
+            const OperationTarget target = { serial, messageIds(), locationKey };
+            res << target;
+        }
+        foreach (const OperationAlias *alias, aliases) {
+            const OperationTarget target = { alias->serial, alias->ids, alias->locationKey };
+            res << target;
+        }
+        return res;
+    }
+
+    /// message ids of the operation itself and of all requests folded into it
+    QMailMessageIdList batchMessageIds() const
+    {
+        QMailMessageIdList res;
+        QSet<QMailMessageId> seen;
+        if (!detached) {
+            res = messageIds();
+            seen = res.toSet();
+        }
+        foreach (const OperationAlias *alias, aliases) {
+            foreach (const QMailMessageId &id, alias->ids) {
+                if (!seen.contains(id)) {
+                    seen.insert(id);
+                    res << id;
+                }
+            }
+        }
+        return res;
+    }
 };
 
 
 
+/**
+ * Operations of a single account. Only one operation of a lane runs at a time,
+ * while lanes of different accounts run in parallel.
+ *
+ * Queued operations are kept in a binary heap ordered by deadline (earliest
+ * first), so a waiting operation eventually gets ahead of more important ones
+ * arriving later. Reprioritising pushes a new entry, the old one goes stale.
+ */
+struct OperationLane
+{
+    struct Entry
+    {
+        qint64 deadline;
+        quint64 order;  // FIFO among equal deadlines
+        uint generation;
+        OperationContext *operation;
+
+        bool operator<(const Entry &other) const  // "later than", for a min-heap
+        {
+            return deadline != other.deadline ? deadline > other.deadline
+                                              : order > other.order;
+        }
+    };
+
+    OperationLane(const QMailAccountId &account_id)
+      : accountId (account_id),
+        current (NULL),
+        order (0)
+    {}
+
+    QMailAccountId accountId;
+    OperationContext *current;
+    QVector<Entry> heap;
+    quint64 order;
+    QHash<QString, OperationContext *> batches;  // queued operations accepting folded requests
+
+    void push(OperationContext *operation)
+    {
+        Entry entry = { operation->deadline, ++order, operation->generation, operation };
+        operation->queued++;
+        heap.append(entry);
+        std::push_heap(heap.begin(), heap.end());
+    }
+
+    /// first queued operation, stale and cancelled entries are dropped on the way
+    OperationContext * head()
+    {
+        while (!heap.isEmpty()) {
+            OperationContext *operation = heap.first().operation;
+            if (!operation->cancelled && heap.first().generation == operation->generation)
+                return operation;
+            pop();
+        }
+        return NULL;
+    }
 
-ServiceActionManager::ServiceActionManager(QObject *parent)
+    OperationContext * take()
+    {
+        OperationContext *operation = head();
+        Q_ASSERT (operation);
+        pop();
+        return operation;
+    }
+
+private:
+    void pop()
+    {
+        OperationContext *operation = heap.first().operation;
+        std::pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+        if (0 == --operation->queued && operation->cancelled)
+            delete operation;
+    }
+};
+
+
+
+/**
+ * Decides whether and when a failed operation is attempted again, depending on
+ * the error code. Transient errors are retried with an exponential backoff.
+ */
+class RetryPolicy
+{
+public:
+    enum Kind {
+        Fatal = 0,
+        Immediate,  // messageserver was restarted, nothing to wait for
+        Transient
+    };
+
+    RetryPolicy()
+    {
+        const QSettings settings;
+        mMaxAttempts = settings.value("operation_retry_attempts", 5).toUInt();
+        mBaseDelay = qMax(1, settings.value("operation_retry_delay", 1000).toInt());
+        mMaxDelay = qMax(mBaseDelay, settings.value("operation_retry_max_delay", 60000).toInt());
+
+        mKinds.insert(QMailServiceAction::Status::ErrInternalStateReset, Immediate);
+        mKinds.insert(QMailServiceAction::Status::ErrTimeout, Transient);
+        mKinds.insert(QMailServiceAction::Status::ErrNoConnection, Transient);
+        mKinds.insert(QMailServiceAction::Status::ErrConnectionNotReady, Transient);
+        mKinds.insert(QMailServiceAction::Status::ErrConnectionInUse, Transient);
+
+        qsrand(QTime::currentTime().msec());
+    }
+
+    Kind classify(QMailServiceAction::Status::ErrorCode code) const { return mKinds.value(code, Fatal); }
+
+    /// milliseconds to wait before the attempt, -1 if it should not be made
+    int delay(QMailServiceAction::Status::ErrorCode code, uint attempt) const
+    {
+        if (attempt > mMaxAttempts)
+            return -1;
+
+        switch (classify(code)) {
+
+        case Immediate:
+            return 0;
+
+        case Transient: {
+            int res = mBaseDelay;
+            for (uint i = 1; i < attempt && res < mMaxDelay; ++i)
+                res *= 2;
+            res = qMin(res, mMaxDelay);
+            // +/-25% jitter, so failed operations don't come back all at once
+            return res - res / 4 + qrand() % (res / 2 + 1);
+        }
+
+        default:
+            return -1;
+        }
+    }
+
+private:
+    QHash<int, Kind> mKinds;
+    uint mMaxAttempts;
+    int mBaseDelay;
+    int mMaxDelay;
+};
+
+
+
+/**
+ * Durations of the latest operations of one type, for the queue wait and
+ * execution time histograms. Bucket 0 counts durations under a millisecond,
+ * bucket i those in [2^(i-1), 2^i) ms, the last one all the longer ones.
+ */
+class OperationSamples
+{
+public:
+    enum { Buckets = 24 };
+
+    explicit OperationSamples(int capacity) : mCapacity (capacity), mNextWait (0), mNextExec (0) {}
+
+    void addQueueWait(qint64 msecs) { add(mWait, mNextWait, msecs); }
+    void addExecTime(qint64 msecs) { add(mExec, mNextExec, msecs); }
+
+    QVector<uint> queueWaitHistogram() const { return histogram(mWait); }
+    QVector<uint> execTimeHistogram() const { return histogram(mExec); }
+
+private:
+    void add(QVector<qint64> &samples, int &next, qint64 msecs)
+    {
+        if (samples.count() < mCapacity)
+            samples.append(msecs);
+        else
+            samples[next] = msecs;
+        next = (next + 1) % mCapacity;
+    }
+
+    static QVector<uint> histogram(const QVector<qint64> &samples)
+    {
+        QVector<uint> res(Buckets, 0);
+        foreach (qint64 msecs, samples) {
+            int bucket = 0;
+            while (msecs > 0 && bucket < Buckets - 1) {
+                msecs >>= 1;
+                bucket++;
+            }
+            res[bucket]++;
+        }
+        return res;
+    }
+
+    int mCapacity;
+    QVector<qint64> mWait;
+    QVector<qint64> mExec;
+    int mNextWait;
+    int mNextExec;
+};
+
+
+
+namespace {
+
+QString ids_key(const QMailMessageIdList &ids)
+{
+    QList<quint64> numbers;
+    foreach (const QMailMessageId &id, ids)
+        numbers << id.toULongLong();
+    qSort(numbers);
+
+    QStringList res;
+    foreach (quint64 number, numbers)
+        res << QString::number(number);
+    return res.join(",");
+}
+
+}  // namespace
+
+
+
+
+/**
+ * Takes ownership of the server. Besides the instance(), managers are only
+ * made for benchmarks, typically with a FakeMessageServer.
+ */
+ServiceActionManager::ServiceActionManager(MessageServer *server, QObject *parent)
   : QObject (parent),
-    mServer (new QMailMessageServer(this)),
-    mCurrent (NULL),
+    mServer (server),
+    mMaxRunning (qMax(1, QSettings().value("max_concurrent_operations", 4).toInt())),
+    mRetryPolicy (new RetryPolicy),
     mSerial (0)
 {
+    const QSettings settings;
+    mStatsWindow = qMax(1, settings.value("operation_stats_window", 256).toInt());
+    mDeadlines[Low] = settings.value("operation_deadline_low", 30000).toInt();
+    mDeadlines[Normal] = settings.value("operation_deadline_normal", 5000).toInt();
+    mDeadlines[High] = settings.value("operation_deadline_high", 0).toInt();
+    mClock.start();
+    mServer->setParent(this);
+
+    mRetryTimer.setSingleShot(true);
+    CONNECT (&mRetryTimer, SIGNAL(timeout()), this, SLOT(on_retryTimeout()));
+
+    mProgressTimer.setSingleShot(true);
+    setProgressRate(settings.value("progress_update_rate", 30).toInt());
+    CONNECT (&mProgressTimer, SIGNAL(timeout()), this, SLOT(on_progressTimeout()));
+
     CONNECT (mServer, SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)),
              this, SLOT(on_activityChanged(quint64,QMailServiceAction::Activity)));
     CONNECT (mServer, SIGNAL(connectivityChanged(quint64,QMailServiceAction::Connectivity)),
@@ -50,36 +392,188 @@ ServiceActionManager::ServiceActionManager(QObject *parent)
 }
 
 
+ServiceActionManager::~ServiceActionManager()
+{
+    foreach (Subscriber *subscriber, mSubscriptions.keys())
+        subscriber->mManager = NULL;
+
+    // stale queue entries may still refer to operations already forgotten
+    QSet<OperationContext *> operations = mOperations.values().toSet();
+    foreach (const OperationLane *lane, mLanes) {
+        foreach (const OperationLane::Entry &entry, lane->heap)
+            operations.insert(entry.operation);
+    }
+    qDeleteAll(operations);
+    qDeleteAll(mAliases);
+    qDeleteAll(mLanes);
+    qDeleteAll(mSamples);
+    delete mRetryPolicy;
+}
+
+
+ServiceActionManager::Subscriber::~Subscriber()
+{
+    if (mManager)
+        mManager->unsubscribe(this);
+}
+
+
 ServiceActionManager * ServiceActionManager::instance()
 {
     static ServiceActionManager *self = NULL;
-    if (NULL == self)
-        self = new ServiceActionManager();
+    if (NULL == self) {
+#ifdef F2_FAKE_MESSAGESERVER
+        self = new ServiceActionManager(new FakeMessageServer);
+#else
+        self = new ServiceActionManager(new QmfMessageServer);
+#endif
+    }
     return self;
 }
 
 
+/**
+ * Sets how long (in milliseconds) operations of the priority class may wait
+ * before they are scheduled ahead of more important ones queued after them.
+ */
+void ServiceActionManager::setDeadline(Priority priority, int msecs)
+{
+    Q_ASSERT (Low <= priority && priority <= High);
+    mDeadlines[priority] = qMax(0, msecs);
+}
+
+
+/**
+ * Sets how many times per second, at most, progress of an operation is
+ * reported. Updates in between are coalesced, only the latest one is sent.
+ */
+void ServiceActionManager::setProgressRate(int hz)
+{
+    mProgressTimer.setInterval(1000 / qBound(1, hz, 1000));
+}
+
+
+/** Changes the priority of a queued or running operation. */
+void ServiceActionManager::setPriority(quint64 serial, Priority priority)
+{
+    OperationContext *operation = mOperations.value(serial);
+    if (OperationAlias *alias = mAliases.value(serial))
+        operation = alias->target;
+
+    if (operation && !operation->cancelled)
+        _reprioritise(operation, priority);
+}
+
+
+/** Makes the subscriber receive events of all operations. */
+void ServiceActionManager::subscribe(Subscriber *subscriber)
+{
+    bool &all = _subscriptions(subscriber).all;
+    if (all)
+        return;
+
+    all = true;
+    mAllSubscribers << subscriber;
+}
+
+
+/**
+ * Makes the subscriber receive activity and progress of the operations (both
+ * the present and future ones) covering the message.
+ */
+void ServiceActionManager::subscribe(const QMailMessageId &id, Subscriber *subscriber)
+{
+    QSet<QMailMessageId> &ids = _subscriptions(subscriber).ids;
+    if (ids.contains(id))
+        return;
+
+    ids.insert(id);
+    mIdSubscribers[id] << subscriber;
+}
+
+
+void ServiceActionManager::subscribe(const QMailMessagePart::Location &location, Subscriber *subscriber)
+{
+    const QString &location_str = location.toString(true);
+    QSet<QString> &locations = _subscriptions(subscriber).locations;
+    if (locations.contains(location_str))
+        return;
+
+    locations.insert(location_str);
+    mLocationSubscribers[location_str] << subscriber;
+}
+
+
+void ServiceActionManager::unsubscribe(const QMailMessageId &id, Subscriber *subscriber)
+{
+    QHash<Subscriber *, Subscriptions>::iterator it = mSubscriptions.find(subscriber);
+    if (mSubscriptions.end() == it || !it->ids.remove(id))
+        return;
+
+    QList<Subscriber *> &subscribers = mIdSubscribers[id];
+    subscribers.removeOne(subscriber);
+    if (subscribers.isEmpty())
+        mIdSubscribers.remove(id);
+}
+
+
+void ServiceActionManager::unsubscribe(Subscriber *subscriber)
+{
+    if (this == subscriber->mManager)
+        subscriber->mManager = NULL;
+    const Subscriptions &subscriptions = mSubscriptions.take(subscriber);
+
+    if (subscriptions.all)
+        mAllSubscribers.removeOne(subscriber);
+
+    foreach (const QMailMessageId &id, subscriptions.ids) {
+        QList<Subscriber *> &subscribers = mIdSubscribers[id];
+        subscribers.removeOne(subscriber);
+        if (subscribers.isEmpty())
+            mIdSubscribers.remove(id);
+    }
+
+    foreach (const QString &location, subscriptions.locations) {
+        QList<Subscriber *> &subscribers = mLocationSubscribers[location];
+        subscribers.removeOne(subscriber);
+        if (subscribers.isEmpty())
+            mLocationSubscribers.remove(location);
+    }
+}
+
+
 void ServiceActionManager::cancelOperation(quint64 serial)
 {
-    if (mCurrent && mCurrent->serial == serial) {
-        mCurrent->cancelOperation(mServer);
+    if (OperationAlias *alias = mAliases.value(serial)) {
+        _cancelAlias(alias);
         return;
     }
 
-    if (mQueue.isEmpty())
+    OperationContext *operation = mOperations.value(serial);
+    if (NULL == operation || operation->detached)
         return;
 
-    // qFind
-    QList<OperationContext*>::iterator it = mQueue.begin();
-    while (mQueue.end() != it && (*it)->serial != serial) ++it;
-    if (mQueue.end() == it)
+    const OperationTarget target = { serial, operation->messageIds(), operation->locationKey };
+
+    if (!operation->aliases.isEmpty()) {
+        // folded requests still need it, keep it (queued or running) for them only
+        _removeFromMessageIdsCache(serial, target.ids, target.location);
+        operation->detached = true;
+        _notifyActivity(target, QMailServiceAction::Failed);
         return;
+    }
+
+    if (mRunning.contains(serial)) {
+        // identical requests made until the cancellation is confirmed start anew
+        _uncoalesce(operation->key, serial);
+        // if preempted, make sure it won't be restarted
+        operation->preempted = false;
+        operation->cancelOperation(mServer);
+        return;
+    }
 
-    OperationContext *operation(*it);
-    _removeFromMessageIdsCache(operation->serial);
-    mQueue.erase(it);
-    emit activityChanged(operation->serial, QMailServiceAction::Failed); // QMailServiceAction::Successful?
-    delete operation;
+    _drop(operation);
+    _notifyActivity(target, QMailServiceAction::Failed); // QMailServiceAction::Successful?
 }
 
 
@@ -87,22 +581,24 @@ quint64 ServiceActionManager::retrieveFolderList(const QMailAccountId &account_i
 {
     class Operation : public OperationContext
     {
-        QMailAccountId accountId;
         QMailFolderId folderId;
         bool descending;
     public:
         Operation(const QMailAccountId &account_id, const QMailFolderId &folder_id, bool is_descending)
-          : accountId (account_id), folderId (folder_id), descending (is_descending) { priority = Low; }
-        void exec(QMailMessageServer *server)
+          : folderId (folder_id), descending (is_descending) { priority = Low; accountId = account_id; }
+        const char * type() const { return "retrieveFolderList"; }
+        void exec(MessageServer *server)
         {
             server->retrieveFolderList(serial, accountId, folderId, descending);
         }
+        QString coalescingKey() const
+        {
+            return QString("retrieveFolderList:%1:%2:%3").arg(accountId.toULongLong())
+                    .arg(folderId.toULongLong()).arg(descending);
+        }
     };
 
-    auto op = new Operation(account_id, folder_id, is_descending);
-    op->serial = ++mSerial;
-    _enqueue(op);
-    return op->serial;
+    return _enqueue(new Operation(account_id, folder_id, is_descending));
 }
 
 
@@ -110,94 +606,225 @@ quint64 ServiceActionManager::retrieveMessageList(const QMailAccountId &accountI
 {
     class Operation : public OperationContext
     {
-        QMailAccountId accountId;
         QMailFolderId folderId;
         uint minimum;
         QMailMessageSortKey sort;
     public:
         Operation(const QMailAccountId &account_id, const QMailFolderId &folder_id, uint minimum_count, const QMailMessageSortKey &sort_key)
-          : accountId (account_id), folderId (folder_id), minimum (minimum_count), sort (sort_key) { priority = Low; }
-        void exec(QMailMessageServer *server)
+          : folderId (folder_id), minimum (minimum_count), sort (sort_key) { priority = Low; accountId = account_id; }
+        const char * type() const { return "retrieveMessageList"; }
+        void exec(MessageServer *server)
         {
             server->retrieveMessageList(serial, accountId, folderId, minimum, sort);
         }
+        QString coalescingKey() const
+        {
+            if (!sort.isEmpty())
+                return QString();
+            return QString("retrieveMessageList:%1:%2:%3").arg(accountId.toULongLong())
+                    .arg(folderId.toULongLong()).arg(minimum);
+        }
     };
 
-    auto op = new Operation(accountId, folderId, minimum, sort);
-    op->serial = ++mSerial;
-    _enqueue(op);
-    return op->serial;
+    return _enqueue(new Operation(accountId, folderId, minimum, sort));
 }
 
 
-quint64 ServiceActionManager::retrieveMessagePart(const QMailMessagePart::Location &location)
+quint64 ServiceActionManager::retrieveMessagePart(const QMailAccountId &account_id, const QMailMessagePart::Location &location)
 {
     class Operation : public OperationContext
     {
         QMailMessagePart::Location partLocation;
     public:
-        Operation(const QMailMessagePart::Location &location)
-          : partLocation (location) { priority =  High; }
+        Operation(const QMailAccountId &account_id, const QMailMessagePart::Location &location)
+          : partLocation (location) { priority =  High; accountId = account_id; }
 
         QMailMessageIdList messageIds() const { return QMailMessageIdList() << partLocation.containingMessageId(); }
 
         virtual QMailMessagePart::Location messagePartLocation() const { return partLocation; }
 
-        void exec(QMailMessageServer *server)
+        const char * type() const { return "retrieveMessagePart"; }
+        void exec(MessageServer *server)
         {
+            if (restarted() && progressValue > 0) {
+                // continue from the bytes of the part already in the store, the
+                // range asks for the rest of it; read on restarts only
+                const QMailMessage message(partLocation.containingMessageId());
+                if (message.contains(partLocation)) {
+                    const QMailMessagePart &part = message.partAt(partLocation);
+                    const int downloaded = part.hasBody() ? part.body().length() : 0;
+                    const int size = part.contentDisposition().size();
+                    if (part.partialContentAvailable() && !part.contentAvailable()
+                     && 0 < downloaded && downloaded < size) {
+                        server->retrieveMessagePartRange(serial, partLocation, uint(size));
+                        return;
+                    }
+                }
+            }
             server->retrieveMessagePart(serial, partLocation);
         }
+        QString coalescingKey() const
+        {
+            return "retrieveMessagePart:" + partLocation.toString(true);
+        }
+    };
+
+    Q_ASSERT (location.isValid());
+    return _enqueue(new Operation(account_id, location));
+}
+
+
+quint64 ServiceActionManager::retrieveMessagePartRange(const QMailAccountId &account_id, const QMailMessagePart::Location &location, uint minimum)
+{
+    class Operation : public OperationContext
+    {
+        QMailMessagePart::Location partLocation;
+        uint minimum;
+    public:
+        Operation(const QMailAccountId &account_id, const QMailMessagePart::Location &location, uint minimum_bytes)
+          : partLocation (location), minimum (minimum_bytes) { priority =  High; accountId = account_id; }
+
+        QMailMessageIdList messageIds() const { return QMailMessageIdList() << partLocation.containingMessageId(); }
+
+        virtual QMailMessagePart::Location messagePartLocation() const { return partLocation; }
+
+        const char * type() const { return "retrieveMessagePartRange"; }
+        void exec(MessageServer *server)
+        {
+            server->retrieveMessagePartRange(serial, partLocation, minimum);
+        }
+        QString coalescingKey() const
+        {
+            return QString("retrieveMessagePartRange:%1:%2").arg(partLocation.toString(true)).arg(minimum);
+        }
     };
 
     Q_ASSERT (location.isValid());
-    auto op = new Operation(location);
-    op->serial = ++mSerial;
-    mMessageIdsCache[location.containingMessageId()] << op->serial;
-    mMessageLocationsCache[location.toString(true)] << op->serial;
-    _enqueue(op);
-    return op->serial;
+    return _enqueue(new Operation(account_id, location, minimum));
+}
+
+
+quint64 ServiceActionManager::retrieveMessageRange(const QMailAccountId &account_id, const QMailMessageId &message_id, uint minimum)
+{
+    class Operation : public OperationContext
+    {
+        QMailMessageId messageId;
+        uint minimum;
+    public:
+        Operation(const QMailAccountId &account_id, const QMailMessageId &message_id, uint minimum_bytes)
+          : messageId (message_id), minimum (minimum_bytes) { priority =  High; accountId = account_id; }
+
+        virtual QMailMessageIdList messageIds() const { return QMailMessageIdList() << messageId; }
+
+        const char * type() const { return "retrieveMessageRange"; }
+        void exec(MessageServer *server)
+        {
+            server->retrieveMessageRange(serial, messageId, minimum);
+        }
+        QString coalescingKey() const
+        {
+            return QString("retrieveMessageRange:%1:%2").arg(messageId.toULongLong()).arg(minimum);
+        }
+    };
+
+    Q_ASSERT (message_id.isValid());
+    return _enqueue(new Operation(account_id, message_id, minimum));
 }
 
 
-quint64 ServiceActionManager::retrieveMessages(const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification retrival_spec)
+quint64 ServiceActionManager::retrieveMessages(const QMailAccountId &account_id, const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification retrival_spec)
 {
     class Operation : public OperationContext
     {
         QMailMessageIdList _messageIds;
         QMailRetrievalAction::RetrievalSpecification spec;
     public:
-        Operation(const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification retrival_spec)
-          : _messageIds (message_ids), spec (retrival_spec) { priority =  High; }
+        Operation(const QMailAccountId &account_id, const QMailMessageIdList &message_ids, QMailRetrievalAction::RetrievalSpecification retrival_spec)
+          : _messageIds (message_ids), spec (retrival_spec) { priority =  High; accountId = account_id; }
 
         virtual QMailMessageIdList messageIds() const { return _messageIds; }
 
-        void exec(QMailMessageServer *server)
+        const char * type() const { return "retrieveMessages"; }
+        void exec(MessageServer *server)
+        {
+            const QMailMessageIdList &ids = batchMessageIds();
+            if (restarted() && QMailRetrievalAction::Content == spec && ids.count() == 1) {
+                // continue from the bytes already in the store
+                const QMailMessageMetaData message(ids.first());
+                if (message.size() > 0 && message.partialContentAvailable() && !message.contentAvailable()) {
+                    server->retrieveMessageRange(serial, ids.first(), message.size());
+                    return;
+                }
+            }
+            server->retrieveMessages(serial, ids, spec);
+        }
+        QString coalescingKey() const
+        {
+            return QString("retrieveMessages:%1:%2").arg(spec).arg(ids_key(_messageIds));
+        }
+        QString batchKey() const
         {
-            server->retrieveMessages(serial, _messageIds, spec);
+            return QString("retrieveMessages:%1").arg(spec);
         }
     };
 
-    auto op = new Operation(message_ids, retrival_spec);
-    op->serial = ++mSerial;
-    foreach (const QMailMessageId &id, message_ids)
-        mMessageIdsCache[id] << op->serial;
-    _enqueue(op);
-    return op->serial;
+    return _enqueue(new Operation(account_id, message_ids, retrival_spec));
 }
 
 
 ServiceActionManager::OperationInfo * ServiceActionManager::operationInfo(quint64 serial) const
 {
-    if (mCurrent && mCurrent->serial == serial)
-        return mCurrent;
+    if (OperationAlias *alias = mAliases.value(serial))
+        return alias;
 
-    // qFind
-    QList<OperationContext*>::const_iterator it = mQueue.constBegin();
-    while (mQueue.constEnd() != it && (*it)->serial != serial) ++it;
-    if (mQueue.constEnd() == it)
+    OperationContext *operation = mOperations.value(serial);
+    if (NULL == operation || operation->detached)
         return NULL;
 
-    return (*it);
+    return operation;
+}
+
+
+/**
+ * Timings and counters of a queued, running or recently finished operation.
+ * A folded request reports those of the operation it was folded into.
+ */
+ServiceActionManager::OperationStats ServiceActionManager::operationStats(quint64 serial) const
+{
+    if (OperationAlias *alias = mAliases.value(serial))
+        serial = alias->target->serial;
+
+    if (const OperationContext *operation = mOperations.value(serial))
+        return _stats(operation);
+
+    return mFinishedStats.value(serial);
+}
+
+
+QStringList ServiceActionManager::operationTypes() const
+{
+    return mSamples.keys();
+}
+
+
+/**
+ * How long the latest operations of the type waited in the queue before
+ * each of their attempts, see OperationSamples for the bucket bounds.
+ */
+QVector<uint> ServiceActionManager::queueWaitHistogram(const QString &type) const
+{
+    if (OperationSamples *samples = mSamples.value(type))
+        return samples->queueWaitHistogram();
+    return QVector<uint>(OperationSamples::Buckets, 0);
+}
+
+
+/// How long each attempt of the latest operations of the type took to run.
+QVector<uint> ServiceActionManager::execTimeHistogram(const QString &type) const
+{
+    if (OperationSamples *samples = mSamples.value(type))
+        return samples->execTimeHistogram();
+    return QVector<uint>(OperationSamples::Buckets, 0);
 }
 
 
@@ -207,44 +834,50 @@ void ServiceActionManager::on_activityChanged(quint64 serial, QMailServiceAction
     qDebug() << "@ServiceActionManager::on_activityChanged: [" << serial << "]"
              << activity_str[activity];
 
-    if (NULL == mCurrent || mCurrent->serial != serial)
+    OperationContext *operation = mRunning.value(serial);
+    if (NULL == operation)
         return;
 
     switch (activity) {
 
     case QMailServiceAction::Successful:
-    case QMailServiceAction::Failed:
-        if (QMailServiceAction::Status::ErrInternalStateReset == mCurrent->status.errorCode) {
-            qWarning() << "@ServiceActionManager::on_activityChanged:"
-                       << "restarting operation [" << serial << "]"
-                       << "after an ErrInternalStateReset";
-            mCurrent->exec(mServer);
-            Q_ASSERT (mCurrent->serial != 0);
+    case QMailServiceAction::Failed: {
+        mRunning.remove(serial);
+        operation->lane->current = NULL;
+
+        const qint64 now = mClock.elapsed();
+        operation->executed += now - operation->startedAt;
+        operation->queuedAt = now;
+        _samples(operation)->addExecTime(now - operation->startedAt);
+
+        const QList<OperationTarget> &targets = operation->targets();
+        if (operation->preempted) {  // operation was rescheduled
+            operation->preempted = false;
+            operation->status = QMailServiceAction::Status();
+            operation->generation++;
+            operation->lane->push(operation);
+            foreach (const OperationTarget &target, targets)
+                _notifyActivity(target, QMailServiceAction::Pending);
+        }
+        else if (_retry(operation)) {
+            foreach (const OperationTarget &target, targets)
+                _notifyActivity(target, QMailServiceAction::Pending);
         }
         else {
-//            quint64 serial = mCurrent->serial;
-            if (mQueue.contains(mCurrent)) {  // operation was rescheduled
-                mCurrent = NULL;
-                emit activityChanged(serial, QMailServiceAction::Pending);
-            }
-            else {
-                _removeFromMessageIdsCache(mCurrent->serial);
-                delete mCurrent;
-                mCurrent = NULL;
-                emit activityChanged(serial, activity);
-            }
-
-            if (!mQueue.empty()) {
-                mCurrent = mQueue.takeFirst();
-                mCurrent->exec(mServer);
-                Q_ASSERT (mCurrent->serial != 0);
-            }
+            _release(operation);
+            foreach (const OperationTarget &target, targets)
+                _notifyActivity(target, activity);
         }
-        break;
+
+        _schedule();
+        if (mRunning.isEmpty())  // the last one finished
+            emit aggregateProgressChanged(0, 0);
+    }   break;
 
     case QMailServiceAction::Pending:
     case QMailServiceAction::InProgress:
-        emit activityChanged(mCurrent->serial, activity);
+        foreach (const OperationTarget &target, operation->targets())
+            _notifyActivity(target, activity);
         break;
 
     default:
@@ -254,21 +887,76 @@ void ServiceActionManager::on_activityChanged(quint64 serial, QMailServiceAction
 }
 
 
+void ServiceActionManager::on_retryTimeout()
+{
+    const qint64 now = mClock.elapsed();
+    while (!mRetries.isEmpty() && mRetries.begin().key() <= now) {
+        OperationContext *operation = mRetries.begin().value();
+        mRetries.erase(mRetries.begin());
+        operation->retryAt = 0;
+        operation->queuedAt = now;
+        operation->generation++;
+        operation->lane->push(operation);
+    }
+
+    _armRetryTimer();
+    _schedule();
+}
+
+
 void ServiceActionManager::on_connectivityChanged(quint64 serial, QMailServiceAction::Connectivity c)
 {
-    if (NULL == mCurrent || mCurrent->serial != serial)
+    OperationContext *operation = mRunning.value(serial);
+    if (NULL == operation)
         return;
 
-    emit connectivityChanged(serial, c);
+    foreach (const OperationTarget &target, operation->targets())
+        emit connectivityChanged(target.serial, c);
 }
 
 
 void ServiceActionManager::on_progressChanged(quint64 serial, uint value, uint total)
 {
-    if (NULL == mCurrent || mCurrent->serial != serial)
+    OperationContext *operation = mRunning.value(serial);
+    if (NULL == operation)
         return;
 
-    emit progressChanged(serial, value, total);
+    operation->progressValue = value;
+    operation->progressTotal = total;
+    mProgressDirty.insert(operation);
+    if (!mProgressTimer.isActive())
+        mProgressTimer.start();
+}
+
+
+void ServiceActionManager::on_progressTimeout()
+{
+    // listeners may cancel operations, so nothing is dereferenced while emitting
+    struct Update { OperationTarget target; uint value; uint total; };
+    QList<Update> updates;
+    foreach (const OperationContext *operation, mProgressDirty) {
+        foreach (const OperationTarget &target, operation->targets()) {
+            const Update update = { target, operation->progressValue, operation->progressTotal };
+            updates << update;
+        }
+    }
+    mProgressDirty.clear();
+
+    // every operation has an equal share, as their totals are in different units
+    uint value = 0;
+    uint total = 0;
+    foreach (const OperationContext *operation, mRunning) {
+        if (0 == operation->progressTotal)
+            continue;
+        value += quint64(qMin(operation->progressValue, operation->progressTotal)) * 1000 / operation->progressTotal;
+        total += 1000;
+    }
+
+    foreach (const Update &update, updates)
+        _notifyProgress(update.target, update.value, update.total);
+
+    if (total)
+        emit aggregateProgressChanged(value, total);
 }
 
 
@@ -276,59 +964,571 @@ void ServiceActionManager::on_statusChanged(quint64 serial, const QMailServiceAc
 {
     qDebug() << "@ServiceActionManager::on_statusChanged:" << "[" << serial << "]" << s;
 
-    if (NULL == mCurrent || mCurrent->serial != serial)
+    OperationContext *operation = mRunning.value(serial);
+    if (NULL == operation)
         return;
 
-    mCurrent->status = s;
-    emit statusChanged(serial, s);
+    operation->status = s;
+    foreach (const OperationTarget &target, operation->targets())
+        emit statusChanged(target.serial, s);
+}
+
+
+/**
+ * Queues the operation and returns the serial to track it with. An identical
+ * request already queued or running is reused instead, and single-message
+ * requests are folded into a queued batch operation of the same kind. Either
+ * way the caller gets a serial of its own, so cancelling it stops the work
+ * only once no other caller waits for it.
+ */
+quint64 ServiceActionManager::_enqueue(OperationContext *operation)
+{
+    Q_ASSERT (0 == operation->serial);
+
+    operation->key = operation->coalescingKey();
+    if (!operation->key.isEmpty() && mCoalesced.contains(operation->key)) {
+        const quint64 serial = mCoalesced.value(operation->key);
+        OperationContext *target = mOperations.value(serial);
+        if (OperationAlias *alias = mAliases.value(serial))
+            target = alias->target;
+        Q_ASSERT (target);
+        qDebug() << "@ServiceActionManager::_enqueue:"
+                 << "reusing operation [" << target->serial << "]";
+
+        // e.g. a prefetch of the message the user just opened
+        if (target->priority < operation->priority)
+            _reprioritise(target, operation->priority);
+
+        OperationAlias *alias = new OperationAlias(++mSerial, operation->messageIds(), target);
+        alias->location = operation->messagePartLocation();
+        foreach (const QMailMessageId &id, alias->ids)
+            mMessageIdsCache[id] << alias->serial;
+        if (alias->location.isValid()) {
+            alias->locationKey = alias->location.toString(true);
+            mMessageLocationsCache[alias->locationKey] << alias->serial;
+        }
+        target->aliases << alias;
+        mAliases.insert(alias->serial, alias);
+        delete operation;
+
+        const OperationTarget alias_target = { alias->serial, alias->ids, alias->locationKey };
+        _notifyActivity(alias_target, QMailServiceAction::Pending);
+        if (mRunning.contains(target->serial))
+            _notifyActivity(alias_target, QMailServiceAction::InProgress);
+        return alias->serial;
+    }
+
+    operation->serial = ++mSerial;
+    if (!operation->key.isEmpty())
+        mCoalesced.insert(operation->key, operation->serial);
+
+    foreach (const QMailMessageId &id, operation->messageIds())
+        mMessageIdsCache[id] << operation->serial;
+    const QMailMessagePart::Location &location = operation->messagePartLocation();
+    if (location.isValid()) {
+        operation->locationKey = location.toString(true);
+        mMessageLocationsCache[operation->locationKey] << operation->serial;
+    }
+
+    OperationLane *lane = _lane(operation->accountId);
+    operation->lane = lane;
+
+    const QString &batch_key = operation->batchKey();
+    if (!batch_key.isEmpty()) {
+
+        OperationContext *batch = lane->batches.value(batch_key);
+        if (batch && batch->priority == operation->priority && operation->messageIds().count() == 1) {
+
+            OperationAlias *alias = new OperationAlias(operation->serial, operation->messageIds(), batch);
+            alias->key = operation->key;
+            if (!alias->key.isEmpty())
+                mCoalesced.insert(alias->key, alias->serial);
+            batch->aliases << alias;
+            mAliases.insert(alias->serial, alias);
+            delete operation;
+
+            const OperationTarget target = { alias->serial, alias->ids, alias->locationKey };
+            _notifyActivity(target, QMailServiceAction::Pending);
+            return alias->serial;
+        }
+
+        if (NULL == batch)
+            lane->batches.insert(batch_key, operation);
+    }
+
+    operation->enqueuedAt = mClock.elapsed();
+    operation->queuedAt = operation->enqueuedAt;
+    operation->deadline = operation->enqueuedAt + mDeadlines[operation->priority];
+    mOperations.insert(operation->serial, operation);
+    lane->push(operation);
+    _preempt(lane, operation);
+
+    const OperationTarget target = { operation->serial, operation->messageIds(), operation->locationKey };
+    _notifyActivity(target, QMailServiceAction::Pending);
+
+    _schedule();
+    return target.serial;
+}
+
+
+/**
+ * Starts operations on idle lanes while there is a room for them. Lane with
+ * the earliest deadline goes first, lanes with equal ones take turns.
+ */
+void ServiceActionManager::_schedule()
+{
+    while (mRunning.count() < mMaxRunning) {
+
+        OperationLane *next = NULL;
+        foreach (OperationLane *lane, mLaneOrder) {
+            if (lane->current || NULL == lane->head())
+                continue;
+            if (NULL == next || lane->head()->deadline < next->head()->deadline)
+                next = lane;
+        }
+
+        if (NULL == next)
+            return;
+
+        mLaneOrder.move(mLaneOrder.indexOf(next), mLaneOrder.count() - 1);
+        _exec(next, next->take());
+    }
+}
+
+
+/**
+ * Cancels the lane's running operation if the given one is due before it,
+ * it's requeued as soon as the cancellation is confirmed. The lanes are
+ * ordered by deadline, so is preemption: a raised priority only counts
+ * through the earlier deadline it brings. Operations past their deadline are
+ * never preempted, so they can't starve.
+ */
+void ServiceActionManager::_preempt(OperationLane *lane, OperationContext *operation)
+{
+    OperationContext *current = lane->current;
+    if (NULL == current || current->preempted || current->deadline <= operation->deadline)
+        return;
+
+    if (current->deadline <= mClock.elapsed())
+        return;
+
+    current->preempted = true;
+    current->preemptions++;
+    current->cancelOperation(mServer);
+}
+
+
+void ServiceActionManager::_reprioritise(OperationContext *operation, Priority priority)
+{
+    if (operation->priority == priority)
+        return;
+
+    operation->priority = priority;
+    if (mRunning.contains(operation->serial) && !operation->preempted)
+        return;
+
+    // keep the age it earned, but never push it back
+    operation->deadline = qMin(operation->deadline, operation->enqueuedAt + mDeadlines[priority]);
+    if (mRunning.contains(operation->serial) || operation->retryAt)
+        return;  // requeued when the preemption is confirmed or the retry is due
+
+    operation->generation++;
+    operation->lane->push(operation);
+    _preempt(operation->lane, operation);
+    _schedule();
+}
+
+
+void ServiceActionManager::_exec(OperationLane *lane, OperationContext *operation)
+{
+    Q_ASSERT (NULL == lane->current);
+    Q_ASSERT (operation->lane == lane);
+
+    // no more folding into a running operation
+    if (lane->batches.value(operation->batchKey()) == operation)
+        lane->batches.remove(operation->batchKey());
+
+    const qint64 now = mClock.elapsed();
+    operation->waited += now - operation->queuedAt;
+    operation->startedAt = now;
+    _samples(operation)->addQueueWait(now - operation->queuedAt);
+
+    lane->current = operation;
+    mRunning.insert(operation->serial, operation);
+    operation->exec(mServer);
+    Q_ASSERT (operation->serial != 0);
+}
+
+
+OperationLane * ServiceActionManager::_lane(const QMailAccountId &account_id)
+{
+    OperationLane *lane = mLanes.value(account_id);
+    if (NULL == lane) {
+        lane = new OperationLane(account_id);
+        mLanes.insert(account_id, lane);
+        mLaneOrder.append(lane);
+    }
+    return lane;
+}
+
+
+/**
+ * Schedules another attempt of a failed operation if the retry policy allows
+ * it. The operation keeps its serial, but leaves its lane while waiting, so
+ * it doesn't hold up other operations.
+ */
+bool ServiceActionManager::_retry(OperationContext *operation)
+{
+    const int delay = mRetryPolicy->delay(operation->status.errorCode, operation->attempts + 1);
+    if (delay < 0)
+        return false;
+
+    qWarning() << "@ServiceActionManager::_retry:"
+               << "retrying operation [" << operation->serial << "] in" << delay << "ms"
+               << "after" << operation->status;
+
+    operation->attempts++;
+    operation->status = QMailServiceAction::Status();
+
+    if (0 == delay) {
+        operation->generation++;
+        operation->lane->push(operation);
+        return true;
+    }
+
+    operation->retryAt = mClock.elapsed() + delay;
+    mRetries.insert(operation->retryAt, operation);
+    _armRetryTimer();
+    return true;
 }
 
 
-void ServiceActionManager::_enqueue(OperationContext *operation)
+void ServiceActionManager::_armRetryTimer()
 {
-    /// TODO: check for duplicates, is it needed? here?
+    if (mRetries.isEmpty()) {
+        mRetryTimer.stop();
+        return;
+    }
+
+    mRetryTimer.start(int(qMax(Q_INT64_C(0), mRetries.begin().key() - mClock.elapsed())));
+}
 
-    Q_ASSERT (0 != operation->serial);
 
-    if (NULL == mCurrent) {
-        Q_ASSERT (mQueue.isEmpty());
-        mCurrent = operation;
-        mCurrent->exec(mServer);
-        Q_ASSERT (mCurrent->serial != 0);
+void ServiceActionManager::_cancelAlias(OperationAlias *alias)
+{
+    OperationContext *operation = alias->target;
+    operation->aliases.removeOne(alias);
+    mAliases.remove(alias->serial);
+    _uncoalesce(alias->key, alias->serial);
+    _removeFromMessageIdsCache(alias->serial, alias->ids, alias->locationKey);
+
+    const OperationTarget target = { alias->serial, alias->ids, alias->locationKey };
+    delete alias;
+
+    // a detached operation nobody waits for anymore
+    if (operation->detached && operation->aliases.isEmpty()) {
+        if (mRunning.contains(operation->serial)) {
+            _uncoalesce(operation->key, operation->serial);
+            operation->preempted = false;
+            operation->cancelOperation(mServer);
+        }
+        else {
+            _drop(operation);
+        }
     }
-    else {
-        if (mCurrent->priority < operation->priority) {
-            mCurrent->cancelOperation(mServer);
-            mQueue.prepend(mCurrent);
+
+    _notifyActivity(target, QMailServiceAction::Failed);
+}
+
+
+/** Subscriptions of the subscriber, which is bound to this manager from now on. */
+ServiceActionManager::Subscriptions & ServiceActionManager::_subscriptions(Subscriber *subscriber)
+{
+    Q_ASSERT (NULL == subscriber->mManager || this == subscriber->mManager);
+    subscriber->mManager = this;
+    return mSubscriptions[subscriber];
+}
+
+
+QList<ServiceActionManager::Subscriber *> ServiceActionManager::_subscribers(const OperationTarget &target) const
+{
+    QList<Subscriber *> res = mAllSubscribers;
+    QSet<Subscriber *> seen = res.toSet();
+
+    foreach (const QMailMessageId &id, target.ids) {
+        QHash<QMailMessageId, QList<Subscriber *> >::const_iterator it = mIdSubscribers.find(id);
+        if (mIdSubscribers.constEnd() == it)
+            continue;
+        foreach (Subscriber *subscriber, *it) {
+            if (!seen.contains(subscriber)) {
+                seen.insert(subscriber);
+                res << subscriber;
+            }
         }
+    }
 
-        for (int i=0; i < mQueue.count(); ++i) {
-            if (mQueue[i]->priority < operation->priority) {
-                mQueue.insert(i, operation);
-                emit activityChanged(operation->serial, QMailServiceAction::Pending);
-                return;
+    if (!target.location.isEmpty()) {
+        foreach (Subscriber *subscriber, mLocationSubscribers.value(target.location)) {
+            if (!seen.contains(subscriber)) {
+                seen.insert(subscriber);
+                res << subscriber;
             }
         }
+    }
+
+    return res;
+}
 
-        mQueue.append(operation);
+
+void ServiceActionManager::_notifyActivity(const OperationTarget &target, QMailServiceAction::Activity activity)
+{
+    switch (activity) {
+    case QMailServiceAction::Pending:
+        mProgress.insert(target.serial, models::ProgressInfo(target.serial));  // restarted ones too
+        break;
+    case QMailServiceAction::InProgress:
+        if (!mProgress.contains(target.serial))
+            mProgress.insert(target.serial, models::ProgressInfo(target.serial));
+        break;
+    default:
+        mProgress.remove(target.serial);
+    }
+    _progressChanged(target);
+
+    foreach (Subscriber *subscriber, _subscribers(target)) {
+        if (mSubscriptions.contains(subscriber))  // might have gone meanwhile
+            subscriber->operationActivityChanged(target.serial, activity);
+    }
+
+    emit activityChanged(target.serial, activity);
+}
+
+
+void ServiceActionManager::_notifyProgress(const OperationTarget &target, uint value, uint total)
+{
+    QHash<quint64, models::ProgressInfo>::iterator it = mProgress.find(target.serial);
+    if (mProgress.end() != it) {
+        it->setInfo(target.serial, value, total);
+        _progressChanged(target);
     }
 
-    emit activityChanged(operation->serial, QMailServiceAction::Pending);
+    foreach (Subscriber *subscriber, _subscribers(target)) {
+        if (mSubscriptions.contains(subscriber))
+            subscriber->operationProgressChanged(target.serial, value, total);
+    }
+
+    emit progressChanged(target.serial, value, total);
 }
 
 
-void ServiceActionManager::_removeFromMessageIdsCache(quint64 serial)
+/**
+ * Drops the target's combined progress, recombined when asked for next, and
+ * tells the subscribers.
+ */
+void ServiceActionManager::_progressChanged(const OperationTarget &target)
 {
-    foreach (const QMailMessageId &id, mMessageIdsCache.keys()) {
-        mMessageIdsCache[id].removeAll(serial);
-        if (mMessageIdsCache[id].isEmpty())
-            mMessageIdsCache.remove(id);
+    foreach (const QMailMessageId &id, target.ids)
+        mMessageProgress.remove(id);
+    if (!target.location.isEmpty())
+        mLocationProgress.remove(target.location);
+
+    foreach (Subscriber *subscriber, _subscribers(target)) {
+        if (mSubscriptions.contains(subscriber))
+            subscriber->progressInfoChanged(target.ids, target.location);
     }
+}
+
 
-    foreach (const QMailMessagePartContainer::Location &location, mMessageLocationsCache.keys()) {
-        const QString &location_str = location.toString(true);
-        mMessageLocationsCache[location_str].removeAll(serial);
-        if (mMessageLocationsCache[location_str].isEmpty())
-            mMessageLocationsCache.remove(location_str);
+/**
+ * Every operation counts as done to its own fraction, as their totals are in
+ * different units, reported in 1/1000ths. Operations with no progress yet
+ * count as not started; if none has any, the progress is unknown (-1).
+ */
+models::ProgressInfo ServiceActionManager::_combinedProgress(const QList<quint64> &serials) const
+{
+    models::ProgressInfo res;
+    if (serials.isEmpty())
+        return res;
+
+    if (1 == serials.count())
+        return mProgress.value(serials.first(), models::ProgressInfo(serials.first()));
+
+    uint done = 0;
+    bool known = false;
+    foreach (quint64 serial, serials) {
+        const models::ProgressInfo &progress = mProgress.value(serial);
+        if (progress.value() < 0 || progress.total() <= 0)
+            continue;
+        known = true;
+        done += quint64(qMin(progress.value(), progress.total())) * 1000 / progress.total();
     }
+
+    if (known)
+        res.setInfo(serials.first(), done / serials.count(), 1000);
+    else
+        res.setInfo(serials.first());
+    return res;
+}
+
+
+/**
+ * Removes a queued operation. The queue entries are left in place, the
+ * operation is disposed of when the last of them reaches the lane's head.
+ */
+void ServiceActionManager::_drop(OperationContext *operation)
+{
+    OperationLane *lane = operation->lane;
+    if (lane->batches.value(operation->batchKey()) == operation)
+        lane->batches.remove(operation->batchKey());
+
+    if (operation->retryAt) {
+        mRetries.remove(operation->retryAt, operation);
+        operation->retryAt = 0;
+    }
+
+    _release(operation);
+}
+
+
+/** Forgets the operation and the requests folded into it. */
+void ServiceActionManager::_forget(OperationContext *operation)
+{
+    mProgressDirty.remove(operation);
+
+    foreach (OperationAlias *alias, operation->aliases) {
+        mAliases.remove(alias->serial);
+        _uncoalesce(alias->key, alias->serial);
+        _removeFromMessageIdsCache(alias->serial, alias->ids, alias->locationKey);
+        delete alias;
+    }
+    operation->aliases.clear();
+
+    _uncoalesce(operation->key, operation->serial);
+    if (!operation->detached)
+        _removeFromMessageIdsCache(operation->serial, operation->messageIds(), operation->locationKey);
+
+    mOperations.remove(operation->serial);
+}
+
+
+models::ProgressInfo ServiceActionManager::progress(quint64 serial) const
+{
+    return mProgress.value(serial);
+}
+
+
+models::ProgressInfo ServiceActionManager::progress(const QMailMessageId &id) const
+{
+    QHash<QMailMessageId, models::ProgressInfo>::const_iterator it = mMessageProgress.constFind(id);
+    if (mMessageProgress.constEnd() != it)
+        return *it;
+
+    const models::ProgressInfo &res = _combinedProgress(mMessageIdsCache.value(id));
+    if (!res.isNull())
+        mMessageProgress.insert(id, res);
+    return res;
+}
+
+
+models::ProgressInfo ServiceActionManager::progress(const QMailMessagePartContainer::Location &location) const
+{
+    const QString &location_str = location.toString(true);
+    QHash<QString, models::ProgressInfo>::const_iterator it = mLocationProgress.constFind(location_str);
+    if (mLocationProgress.constEnd() != it)
+        return *it;
+
+    const models::ProgressInfo &res = _combinedProgress(mMessageLocationsCache.value(location_str));
+    if (!res.isNull())
+        mLocationProgress.insert(location_str, res);
+    return res;
+}
+
+
+OperationSamples * ServiceActionManager::_samples(const OperationContext *operation)
+{
+    const QString type = operation->type();
+    OperationSamples *samples = mSamples.value(type);
+    if (NULL == samples) {
+        samples = new OperationSamples(mStatsWindow);
+        mSamples.insert(type, samples);
+    }
+    return samples;
+}
+
+
+ServiceActionManager::OperationStats ServiceActionManager::_stats(const OperationContext *operation) const
+{
+    OperationStats stats;
+    stats.type = operation->type();
+    stats.enqueuedAt = operation->enqueuedAt;
+    stats.deadline = operation->deadline;
+    stats.startedAt = operation->startedAt;
+    stats.waited = operation->waited;
+    stats.executed = operation->executed;
+    stats.preemptions = operation->preemptions;
+    stats.attempts = operation->attempts;
+    stats.progressValue = operation->progressValue;
+    stats.progressTotal = operation->progressTotal;
+    return stats;
+}
+
+
+/// Keeps the stats of the latest finished (or dropped) operations around.
+void ServiceActionManager::_archive(const OperationContext *operation)
+{
+    OperationStats stats = _stats(operation);
+    stats.finishedAt = mClock.elapsed();
+
+    mFinishedStats.insert(operation->serial, stats);
+    mFinishedOrder.enqueue(operation->serial);
+    while (mFinishedOrder.count() > mStatsWindow)
+        mFinishedStats.remove(mFinishedOrder.dequeue());
+
+    qDebug() << "@ServiceActionManager::_archive: [" << operation->serial << "]" << stats.type
+             << "waited" << stats.waited << "ms, ran" << stats.executed << "ms,"
+             << stats.preemptions << "preemptions," << stats.attempts << "retries";
+}
+
+
+void ServiceActionManager::_release(OperationContext *operation)
+{
+    _archive(operation);
+    _forget(operation);
+    if (operation->queued)
+        operation->cancelled = true;  // stale queue entries still refer to it
+    else
+        delete operation;
+}
+
+
+/// identical requests are no longer folded into the serial's operation
+void ServiceActionManager::_uncoalesce(const QString &key, quint64 serial)
+{
+    if (!key.isEmpty() && mCoalesced.value(key) == serial)
+        mCoalesced.remove(key);
+}
+
+
+void ServiceActionManager::_removeFromMessageIdsCache(quint64 serial, const QMailMessageIdList &ids, const QString &location)
+{
+    foreach (const QMailMessageId &id, ids) {
+        mMessageProgress.remove(id);
+        QHash<QMailMessageId, QList<quint64> >::iterator it = mMessageIdsCache.find(id);
+        if (mMessageIdsCache.end() == it)
+            continue;
+        it->removeOne(serial);
+        if (it->isEmpty())
+            mMessageIdsCache.erase(it);
+    }
+
+    if (location.isEmpty())
+        return;
+
+    mLocationProgress.remove(location);
+    QHash<QString, QList<quint64> >::iterator it = mMessageLocationsCache.find(location);
+    if (mMessageLocationsCache.end() == it)
+        return;
+    it->removeOne(serial);
+    if (it->isEmpty())
+        mMessageLocationsCache.erase(it);
 }
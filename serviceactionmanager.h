@@ -4,11 +4,25 @@
 
 
 #include <QObject>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QQueue>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
 #include <qmfclient/qmailserviceaction.h>
 //#include <qmfclient/qmailmessage.h>
 
-class QMailMessageServer;
+#include "models/progressinfo.h"
+
+class MessageServer;
 class OperationContext;
+class OperationAlias;
+struct OperationLane;
+class RetryPolicy;
+struct OperationTarget;
+class OperationSamples;
 
 
 
@@ -16,12 +30,27 @@ class OperationContext;
  * Why ServiceActionManager:
  *
  * 1. Avoid concurent service actions (queue)
- *    1a. priotirized queue.
+ *    1a. priotirized queue, waiting operations age so none starves.
+ *    1b. one queue (lane) per account, so accounts don't wait for each other;
+ *        number of lanes running at once is capped.
  * 2. Reuse of QMailServiceAction objects (pools)
  * 3. Removal of duplicated
+ *    3a. identical requests share one operation, each with a serial of its
+ *        own; single-message retrievals are folded into one batched server
+ *        call.
  * 4. Ability to monitor states changes and progress far *all* service actions.
  *    Note, usefulness of QMailActionObserver/QMailActionInfo have to be
  *    investigated, but at least it doesn't allow to cacncel.
+ * 5. Retrying operations failed for a transient reason (e.g. lost connection),
+ *    with the same serial.
+ * 6. Progress is reported at a limited rate, with a combined progress of all
+ *    running operations for a status bar.
+ * 7. Besides the broadcast signals, events are delivered to subscribers of
+ *    particular messages or message parts only.
+ * 8. Timings of operations are recorded, to tell the time spent in our queue
+ *    from the time spent by the messageserver.
+ * 9. Progress of operations is kept in one registry, combined per message
+ *    and per part, for models to read instead of tracking it on their own.
  *
  * QMailStorageAction, QMailRetrievalAction, QMailTransmitAction,
  */
@@ -30,24 +59,83 @@ class ServiceActionManager : public QObject
 {
     Q_OBJECT
 
-    explicit ServiceActionManager(QObject *parent=NULL);
-
 public:
+    explicit ServiceActionManager(MessageServer *server, QObject *parent=NULL);
+    ~ServiceActionManager();
+
+    enum Priority {
+        Low = 0,
+        Normal,
+        High
+    };
+
     class OperationInfo
     {
     public:
         virtual QMailMessageIdList messageIds() const = 0;
         virtual QMailMessagePart::Location messagePartLocation() const = 0;
     };
+
+    /// Times are in milliseconds of the manager's clock, -1 if not reached yet.
+    struct OperationStats
+    {
+        QString type;
+        qint64 enqueuedAt;
+        qint64 deadline;  // queue order, by the same clock
+        qint64 startedAt;  // latest attempt
+        qint64 finishedAt;
+        qint64 waited;  // in the queue, over all attempts
+        qint64 executed;  // running, over all attempts
+        uint preemptions;
+        uint attempts;  // retries
+        uint progressValue;
+        uint progressTotal;
+        OperationStats()
+          : enqueuedAt (-1), deadline (-1), startedAt (-1), finishedAt (-1), waited (0), executed (0),
+            preemptions (0), attempts (0), progressValue (0), progressTotal (0) {}
+        bool isValid() const { return enqueuedAt >= 0; }
+    };
+
+    /**
+     * Receives events of operations covering the messages/parts it subscribed
+     * to. Unsubscribes itself, from the manager it subscribed with, when
+     * destroyed.
+     */
+    class Subscriber
+    {
+    public:
+        Subscriber() : mManager (NULL) {}
+        virtual ~Subscriber();
+        virtual void operationActivityChanged(quint64 serial, QMailServiceAction::Activity activity) { Q_UNUSED (serial); Q_UNUSED (activity); }
+        virtual void operationProgressChanged(quint64 serial, uint value, uint total) { Q_UNUSED (serial); Q_UNUSED (value); Q_UNUSED (total); }
+        /// progress() of these messages and of the part (location key, may be empty) changed
+        virtual void progressInfoChanged(const QMailMessageIdList &ids, const QString &location) { Q_UNUSED (ids); Q_UNUSED (location); }
+    private:
+        friend class ServiceActionManager;
+        ServiceActionManager *mManager;  // has subscriptions of the subscriber, if any
+    };
+
     static ServiceActionManager *instance();
 
 signals:
     void activityChanged(quint64, QMailServiceAction::Activity a);
     void connectivityChanged(quint64, QMailServiceAction::Connectivity c);
     void progressChanged(quint64, uint value, uint total);
+    /// combined progress of the running operations, total is 0 once none is running
+    void aggregateProgressChanged(uint value, uint total);
     void statusChanged(quint64, const QMailServiceAction::Status &s);
 
 public:
+    void setDeadline(Priority priority, int msecs);
+    void setPriority(quint64 serial, Priority priority);
+    void setProgressRate(int hz);
+
+    void subscribe(Subscriber *subscriber);
+    void subscribe(const QMailMessageId &id, Subscriber *subscriber);
+    void subscribe(const QMailMessagePart::Location &location, Subscriber *subscriber);
+    void unsubscribe(const QMailMessageId &id, Subscriber *subscriber);
+    void unsubscribe(Subscriber *subscriber);
+
     /// QMailServiceAction
     void cancelOperation(quint64);
     /// QMailStorageAction
@@ -63,10 +151,11 @@ public:
 //    quint64 exportUpdates(const QMailAccountId &accountId);
     quint64 retrieveFolderList(const QMailAccountId &accountId, const QMailFolderId &folderId, bool descending=true);
     quint64 retrieveMessageList(const QMailAccountId &accountId, const QMailFolderId &folderId, uint minimum=0, const QMailMessageSortKey &sort=QMailMessageSortKey());
-    quint64 retrieveMessagePart(const QMailMessagePart::Location &partLocation);
-//    quint64 retrieveMessagePartRange(const QMailMessagePart::Location &partLocation, uint minimum);
-//    quint64 retrieveMessageRange(const QMailMessageId &messageId, uint minimum);
-    quint64 retrieveMessages(const QMailMessageIdList &messageIds, QMailRetrievalAction::RetrievalSpecification spec=QMailRetrievalAction::MetaData);
+    /// the account of the messages, it is what lane they run in
+    quint64 retrieveMessagePart(const QMailAccountId &accountId, const QMailMessagePart::Location &partLocation);
+    quint64 retrieveMessagePartRange(const QMailAccountId &accountId, const QMailMessagePart::Location &partLocation, uint minimum);
+    quint64 retrieveMessageRange(const QMailAccountId &accountId, const QMailMessageId &messageId, uint minimum);
+    quint64 retrieveMessages(const QMailAccountId &accountId, const QMailMessageIdList &messageIds, QMailRetrievalAction::RetrievalSpecification spec=QMailRetrievalAction::MetaData);
 //    quint64 synchronize(const QMailAccountId &accountId, uint minimum);
     /// QMailTransmitAction
 //    quint64 transmitMessages(const QMailAccountId &accountId);
@@ -86,22 +175,86 @@ public:
 
     OperationInfo * operationInfo(quint64 serial) const;
 
+    /// progress registry, null if there are no queued or running operations
+    models::ProgressInfo progress(quint64 serial) const;
+    models::ProgressInfo progress(const QMailMessageId &id) const;
+    models::ProgressInfo progress(const QMailMessagePartContainer::Location &location) const;
+
+    OperationStats operationStats(quint64 serial) const;
+    QStringList operationTypes() const;
+    QVector<uint> queueWaitHistogram(const QString &type) const;
+    QVector<uint> execTimeHistogram(const QString &type) const;
+
 private slots:
     void on_activityChanged(quint64, QMailServiceAction::Activity);
     void on_connectivityChanged(quint64, QMailServiceAction::Connectivity);
     void on_progressChanged(quint64, uint,uint);
     void on_statusChanged(quint64, const QMailServiceAction::Status &);
+    void on_retryTimeout();
+    void on_progressTimeout();
 
 private:
-    QMailMessageServer *mServer;
-    OperationContext *mCurrent;
-    QList<OperationContext *> mQueue;
+    MessageServer *mServer;
+    QHash<QMailAccountId, OperationLane *> mLanes;
+    QList<OperationLane *> mLaneOrder;  // round-robin order for scheduling
+    QHash<quint64, OperationContext *> mOperations;  // queued and running
+    QHash<quint64, OperationContext *> mRunning;
+    QHash<quint64, OperationAlias *> mAliases;
+    QHash<QString, quint64> mCoalesced;
+    int mMaxRunning;
+    int mDeadlines[High + 1];
+    QElapsedTimer mClock;
+    RetryPolicy *mRetryPolicy;
+    QMultiMap<qint64, OperationContext *> mRetries;  // by the time they are due
+    QTimer mRetryTimer;
+    QSet<OperationContext *> mProgressDirty;
+    QTimer mProgressTimer;
+
+    struct Subscriptions
+    {
+        bool all;
+        QSet<QMailMessageId> ids;
+        QSet<QString> locations;
+        Subscriptions() : all (false) {}
+    };
+    QHash<Subscriber *, Subscriptions> mSubscriptions;
+    QList<Subscriber *> mAllSubscribers;
+    QHash<QMailMessageId, QList<Subscriber *> > mIdSubscribers;
+    QHash<QString, QList<Subscriber *> > mLocationSubscribers;
+    int mStatsWindow;  // samples per histogram, finished operations to keep stats of
+    QHash<QString, OperationSamples *> mSamples;
+    QHash<quint64, OperationStats> mFinishedStats;
+    QQueue<quint64> mFinishedOrder;
     QHash<QMailMessageId, QList<quint64> > mMessageIdsCache;
     QHash<QString, QList<quint64> > mMessageLocationsCache;
+    QHash<quint64, models::ProgressInfo> mProgress;  // by target serial
+    mutable QHash<QMailMessageId, models::ProgressInfo> mMessageProgress;  // combined, filled on demand
+    mutable QHash<QString, models::ProgressInfo> mLocationProgress;
     quint64 mSerial;
 
-    void _enqueue(OperationContext *);
-    void _removeFromMessageIdsCache(quint64 serial);
+    quint64 _enqueue(OperationContext *);
+    void _schedule();
+    void _exec(OperationLane *lane, OperationContext *operation);
+    void _preempt(OperationLane *lane, OperationContext *operation);
+    void _reprioritise(OperationContext *operation, Priority priority);
+    bool _retry(OperationContext *operation);
+    void _armRetryTimer();
+    OperationLane * _lane(const QMailAccountId &account_id);
+    void _cancelAlias(OperationAlias *alias);
+    void _drop(OperationContext *operation);
+    void _forget(OperationContext *operation);
+    void _uncoalesce(const QString &key, quint64 serial);
+    void _release(OperationContext *operation);
+    OperationSamples * _samples(const OperationContext *operation);
+    OperationStats _stats(const OperationContext *operation) const;
+    void _archive(const OperationContext *operation);
+    Subscriptions & _subscriptions(Subscriber *subscriber);
+    QList<Subscriber *> _subscribers(const OperationTarget &target) const;
+    void _notifyActivity(const OperationTarget &target, QMailServiceAction::Activity activity);
+    void _notifyProgress(const OperationTarget &target, uint value, uint total);
+    void _progressChanged(const OperationTarget &target);
+    models::ProgressInfo _combinedProgress(const QList<quint64> &serials) const;
+    void _removeFromMessageIdsCache(quint64 serial, const QMailMessageIdList &ids, const QString &location=QString());
 };
 
 
@@ -0,0 +1,13 @@
+include(../tests.pri)
+
+TARGET = tst_folderstree
+TEMPLATE = app
+
+SOURCES += \
+    tst_folderstree.cpp \
+    $$SRC/models/folderindex.cpp \
+    $$SRC/models/folderstreemodel.cpp
+
+HEADERS += \
+    $$SRC/models/folderindex.h \
+    $$SRC/models/folderstreemodel.h
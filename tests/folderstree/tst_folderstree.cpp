@@ -0,0 +1,124 @@
+// Qt
+#include <QCoreApplication>
+#include <QDir>
+#include <QTreeView>
+#include <QtTest>
+
+// QMF
+#include <qmfclient/qmailaccount.h>
+#include <qmfclient/qmailaccountconfiguration.h>
+#include <qmfclient/qmailfolder.h>
+#include <qmfclient/qmailstore.h>
+
+// project
+#include "models/folderstreemodel.h"
+
+
+namespace {
+const int TOP_FOLDERS = 100;
+const int SUBFOLDERS = 99;  // of each top folder, 10k folders in all
+}
+
+
+
+/**
+ * Folder tree benchmarks, over a store of our own with one account holding
+ * 10k folders: a hundred top folders of 99 subfolders each.
+ */
+class TestFoldersTree : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void expandAll();
+    void expandEach();
+
+private:
+    void show(QTreeView *view, models::FoldersTree *tree);
+};
+
+
+
+void TestFoldersTree::initTestCase()
+{
+    const QString &path = QDir::temp().absoluteFilePath("f2-tst_folderstree");
+    QVERIFY (QDir().mkpath(path));
+    qputenv("QMF_DATA", QFile::encodeName(path));
+
+    // left from a previous run
+    QMailStore *store = QMailStore::instance();
+    foreach (const QMailAccountId &id, store->queryAccounts())
+        QVERIFY (store->removeAccount(id));
+
+    QMailAccount account;
+    account.setName("benchmark");
+    account.setStatus(QMailAccount::Enabled, true);
+    QMailAccountConfiguration config;
+    QVERIFY (store->addAccount(&account, &config));
+
+    for (int i = 0; i < TOP_FOLDERS; i++) {
+        QMailFolder top (QString("folder %1").arg(i), QMailFolderId(), account.id());
+        QVERIFY (store->addFolder(&top));
+        for (int j = 0; j < SUBFOLDERS; j++) {
+            QMailFolder sub (QString("folder %1.%2").arg(i).arg(j), top.id(), account.id());
+            QVERIFY (store->addFolder(&sub));
+        }
+    }
+}
+
+
+void TestFoldersTree::show(QTreeView *view, models::FoldersTree *tree)
+{
+    view->setModel(tree);
+    view->resize(400, 600);
+    view->show();
+    QTest::qWaitForWindowShown(view);
+
+    // the account, expanded by hand in the application too
+    view->expand(tree->index(0, 0));
+    QCoreApplication::processEvents();
+}
+
+
+/// the view asks parent() of every node it lays out
+void TestFoldersTree::expandAll()
+{
+    models::FoldersTree tree;
+    QTreeView view;
+    show(&view, &tree);
+    QCOMPARE (tree.rowCount(tree.index(0, 0)), TOP_FOLDERS);
+
+    QBENCHMARK {
+        view.expandAll();
+        view.viewport()->repaint();
+        view.collapseAll();
+        view.viewport()->repaint();
+    }
+}
+
+
+/// each top folder as a user would, a layout and a repaint each time
+void TestFoldersTree::expandEach()
+{
+    models::FoldersTree tree;
+    QTreeView view;
+    show(&view, &tree);
+
+    const QModelIndex &account = tree.index(0, 0);
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < TOP_FOLDERS; i++) {
+            view.expand(tree.index(i, 0, account));
+            view.viewport()->repaint();
+        }
+    }
+
+    for (int i = 0; i < TOP_FOLDERS; i++)
+        QCOMPARE (tree.rowCount(tree.index(i, 0, account)), SUBFOLDERS);
+}
+
+
+
+QTEST_MAIN(TestFoldersTree)
+
+#include "tst_folderstree.moc"
@@ -0,0 +1,13 @@
+include(../tests.pri)
+
+TARGET = tst_messagelistdelegate
+TEMPLATE = app
+
+SOURCES += \
+    tst_messagelistdelegate.cpp \
+    $$SRC/widgets/messagelistdelegate.cpp \
+    $$SRC/models/progressinfo.cpp
+
+HEADERS += \
+    $$SRC/widgets/messagelistdelegate.h \
+    $$SRC/models/progressinfo.h
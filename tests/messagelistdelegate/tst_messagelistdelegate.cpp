@@ -0,0 +1,124 @@
+// Qt
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QListView>
+#include <QScrollBar>
+#include <QtTest>
+
+// project
+#include "models/messagelistmodel.h"
+#include "widgets/messagelistdelegate.h"
+
+
+namespace {
+const int ROWS = 100000;
+}
+
+
+
+/**
+ * Synthetic messages, made up on the fly: the benchmark is about painting,
+ * not about the store.
+ */
+class Messages : public QAbstractListModel
+{
+public:
+    explicit Messages(QObject *parent = 0)
+      : QAbstractListModel (parent),
+        mNewest (QDateTime::currentDateTime())
+    {}
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const
+    {
+        return parent.isValid() ? 0 : ROWS;
+    }
+
+    QVariant data(const QModelIndex &index, int role) const
+    {
+        if (!index.isValid())
+            return QVariant();
+
+        const int row = index.row();
+        switch (role) {
+        case models::MessageListModel::MessageIdRole:
+            return QVariant::fromValue(QMailMessageId(1 + row));
+        case Qt::DisplayRole:
+        case models::MessageListModel::SubjectRole:
+            return QString("Re: benchmark message number %1, with a subject long enough to be elided").arg(row);
+        case models::MessageListModel::SenderRole:
+            return QString("Sender %1").arg(row % 97);
+        case models::MessageListModel::DateRole:
+            return mNewest.addSecs(-60 * row);
+        default:
+            return QVariant();
+        }
+    }
+
+private:
+    QDateTime mNewest;
+};
+
+
+
+/**
+ * Scrolls the message list through 100k rows a page at a time, as dragging
+ * the scroll bar does, and reports the time of a frame (scrolling and a
+ * synchronous repaint), by percentile.
+ */
+class TestMessageListDelegate : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void scroll_data();
+    void scroll();
+};
+
+
+
+void TestMessageListDelegate::scroll_data()
+{
+    QTest::addColumn<int>("percentile");
+
+    QTest::newRow("median") << 50;
+    QTest::newRow("p99") << 99;
+    QTest::newRow("max") << 100;
+}
+
+
+void TestMessageListDelegate::scroll()
+{
+    QFETCH (int, percentile);
+
+    Messages model;
+    QListView view;
+    view.setUniformItemSizes(true);  // as in the main view
+    view.setItemDelegate(new widgets::MessageListDelegate(&view));
+    view.setModel(&model);
+    view.resize(400, 800);
+    view.show();
+    QTest::qWaitForWindowShown(&view);
+
+    QScrollBar *bar = view.verticalScrollBar();
+    QVERIFY (bar->maximum() > 0);
+
+    QList<qreal> frames;  // ms
+    QElapsedTimer timer;
+    for (int value = 0; value <= bar->maximum(); value += bar->pageStep()) {
+        timer.start();
+        bar->setValue(value);
+        view.viewport()->repaint();
+        frames << timer.nsecsElapsed() / 1000000.0;
+    }
+
+    qSort(frames);
+    const int frame = qMin(frames.count() - 1, frames.count() * percentile / 100);
+    QTest::setBenchmarkResult(frames[frame], QTest::WalltimeMilliseconds);
+}
+
+
+
+QTEST_MAIN(TestMessageListDelegate)
+
+#include "tst_messagelistdelegate.moc"
@@ -0,0 +1,24 @@
+include(../tests.pri)
+
+QT -= gui
+
+TARGET = tst_serviceactionmanager
+TEMPLATE = app
+
+# the queue runs against the in-process fake, no messageserver is needed
+DEFINES += F2_FAKE_MESSAGESERVER
+
+SOURCES += \
+    tst_serviceactionmanager.cpp \
+    $$SRC/serviceactionmanager.cpp \
+    $$SRC/messageserver.cpp \
+    $$SRC/fakemessageserver.cpp \
+    $$SRC/models/progressinfo.cpp \
+    $$SRC/debug.cpp
+
+HEADERS += \
+    $$SRC/serviceactionmanager.h \
+    $$SRC/messageserver.h \
+    $$SRC/fakemessageserver.h \
+    $$SRC/models/progressinfo.h \
+    $$SRC/debug.h
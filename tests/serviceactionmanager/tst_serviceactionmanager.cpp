@@ -0,0 +1,367 @@
+// Qt
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QtTest>
+
+// project
+#include "fakemessageserver.h"
+#include "serviceactionmanager.h"
+
+
+#define CONNECT(a,b,c,d) if (!QObject::connect(a,b,c,d)) { Q_ASSERT (false); }
+
+
+namespace {
+const int OPERATIONS = 10000;
+const int ACCOUNTS = 4;  // a lane each
+const int TIMEOUT = 120000;  // ms, for any run to finish
+const quint64 HIGH_FOLDERS = 1000000;  // folder ids of the load, past the others
+
+/// transfers finish within two event loop iterations
+ServiceActionManager * instantManager()
+{
+    FakeMessageServer *server = new FakeMessageServer;
+    server->setTickInterval(0);
+    return new ServiceActionManager(server);
+}
+
+/// distinct folders, so requests are never coalesced
+quint64 retrieveList(ServiceActionManager *manager, int i)
+{
+    return manager->retrieveMessageList(QMailAccountId(1 + i % ACCOUNTS), QMailFolderId(1 + i));
+}
+}
+
+
+
+/**
+ * Counts the operations finished, for a run to wait for. Also records the
+ * order operations start in, with the deadline the manager gave each.
+ */
+class Tracker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Tracker(ServiceActionManager *manager)
+      : succeeded (0),
+        failed (0),
+        mManager (manager)
+    {
+        CONNECT (manager, SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)),
+                 this, SLOT(on_activityChanged(quint64,QMailServiceAction::Activity)));
+    }
+
+    int finished() const { return succeeded + failed; }
+
+    /// runs the event loop until that many operations finished
+    bool waitFor(int count)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (finished() < count && timer.elapsed() < TIMEOUT)
+            QCoreApplication::processEvents();
+        return finished() >= count;
+    }
+
+    /// runs the event loop for a while
+    static void run(int msecs)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (timer.elapsed() < msecs)
+            QCoreApplication::processEvents(QEventLoop::AllEvents, msecs - timer.elapsed());
+    }
+
+    int succeeded;
+    int failed;
+    QSet<quint64> done;
+    QList<quint64> started;  // again when restarted
+    QHash<quint64, qint64> deadlines;  // by the manager's clock
+
+private slots:
+    void on_activityChanged(quint64 serial, QMailServiceAction::Activity activity)
+    {
+        switch (activity) {
+        case QMailServiceAction::InProgress:
+            started << serial;
+            deadlines.insert(serial, mManager->operationStats(serial).deadline);
+            return;
+        case QMailServiceAction::Successful:
+            succeeded++;
+            break;
+        case QMailServiceAction::Failed:
+            failed++;
+            break;
+        default:
+            return;
+        }
+        done.insert(serial);
+    }
+
+private:
+    ServiceActionManager *mManager;
+};
+
+
+
+/**
+ * Keeps a lane saturated with High operations: each one finishing is replaced
+ * by a new one, so a backlog of them is always waiting.
+ */
+class HighLoad : public QObject
+{
+    Q_OBJECT
+
+public:
+    HighLoad(ServiceActionManager *manager, const QMailAccountId &account_id, int backlog)
+      : mManager (manager),
+        mAccountId (account_id),
+        mNext (HIGH_FOLDERS),
+        mStopped (false)
+    {
+        CONNECT (manager, SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)),
+                 this, SLOT(on_activityChanged(quint64,QMailServiceAction::Activity)));
+        for (int i = 0; i < backlog; i++)
+            add();
+    }
+
+    void stop() { mStopped = true; }
+
+private slots:
+    void on_activityChanged(quint64 serial, QMailServiceAction::Activity activity)
+    {
+        if (QMailServiceAction::Successful != activity && QMailServiceAction::Failed != activity)
+            return;
+        if (mSerials.remove(serial) && !mStopped)
+            add();
+    }
+
+private:
+    void add()
+    {
+        const quint64 serial = mManager->retrieveFolderList(mAccountId, QMailFolderId(mNext++));
+        mManager->setPriority(serial, ServiceActionManager::High);
+        mSerials.insert(serial);
+    }
+
+    ServiceActionManager *mManager;
+    QMailAccountId mAccountId;
+    quint64 mNext;
+    bool mStopped;
+    QSet<quint64> mSerials;
+};
+
+
+
+/**
+ * Operation queue benchmarks, against FakeMessageServer: the times are our
+ * bookkeeping and scheduling, there is no server or network to wait for.
+ */
+class TestServiceActionManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void enqueue();
+    void completion();
+    void cancel();
+    void preemption();
+    void manyMessageOperations_data();
+    void manyMessageOperations();
+    void lowPriorityLatencyBound();
+};
+
+
+
+/// restarted message operations read the store, an empty one of our own
+void TestServiceActionManager::initTestCase()
+{
+    const QString &path = QDir::temp().absoluteFilePath("f2-tst_serviceactionmanager");
+    QVERIFY (QDir().mkpath(path));
+    qputenv("QMF_DATA", QFile::encodeName(path));
+}
+
+
+void TestServiceActionManager::enqueue()
+{
+    QScopedPointer<ServiceActionManager> manager (instantManager());
+    Tracker tracker (manager.data());
+
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < OPERATIONS; i++)
+            retrieveList(manager.data(), i);
+    }
+
+    QVERIFY (tracker.waitFor(OPERATIONS));
+    QCOMPARE (tracker.succeeded, OPERATIONS);
+}
+
+
+void TestServiceActionManager::completion()
+{
+    QScopedPointer<ServiceActionManager> manager (instantManager());
+    Tracker tracker (manager.data());
+
+    for (int i = 0; i < OPERATIONS; i++)
+        retrieveList(manager.data(), i);
+
+    QBENCHMARK_ONCE {
+        QVERIFY (tracker.waitFor(OPERATIONS));
+    }
+
+    QCOMPARE (tracker.succeeded, OPERATIONS);
+}
+
+
+void TestServiceActionManager::cancel()
+{
+    QScopedPointer<ServiceActionManager> manager (instantManager());
+    Tracker tracker (manager.data());
+
+    QList<quint64> serials;
+    for (int i = 0; i < OPERATIONS; i++)
+        serials << retrieveList(manager.data(), i);
+
+    // latest first, the worst case for a list scanned from the front
+    QBENCHMARK_ONCE {
+        for (int i = serials.count() - 1; i >= 0; i--)
+            manager->cancelOperation(serials[i]);
+    }
+
+    // running ones are confirmed by the server later
+    QVERIFY (tracker.waitFor(OPERATIONS));
+    QCOMPARE (tracker.failed, OPERATIONS);
+}
+
+
+/**
+ * Every operation raised to High preempts the Low one running in the lane,
+ * which is then requeued: all of them still succeed, once.
+ */
+void TestServiceActionManager::preemption()
+{
+    QScopedPointer<ServiceActionManager> manager (instantManager());
+    Tracker tracker (manager.data());
+
+    const int count = OPERATIONS / 10;
+    for (int i = 0; i < count; i++)
+        manager->retrieveFolderList(QMailAccountId(1), QMailFolderId(1 + i));
+
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < count; i++) {
+            const quint64 serial = manager->retrieveFolderList(QMailAccountId(1), QMailFolderId(1 + count + i));
+            manager->setPriority(serial, ServiceActionManager::High);
+            QCoreApplication::processEvents();
+        }
+        QVERIFY (tracker.waitFor(2 * count));
+    }
+
+    QCOMPARE (tracker.succeeded, 2 * count);
+    QCOMPARE (tracker.failed, 0);
+}
+
+
+void TestServiceActionManager::manyMessageOperations_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("50k") << 50000;
+}
+
+
+/**
+ * Enqueues and completes operations on distinct messages, spread over the
+ * accounts. With lookup, cancel and completion constant-time, the 50k row
+ * takes about five times as long as the 10k one. Message caches are empty
+ * again once all are done.
+ */
+void TestServiceActionManager::manyMessageOperations()
+{
+    QFETCH (int, count);
+
+    QScopedPointer<ServiceActionManager> manager (instantManager());
+    Tracker tracker (manager.data());
+
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < count; i++)
+            manager->retrieveMessageRange(QMailAccountId(1 + i % ACCOUNTS), QMailMessageId(1 + i), 1024);
+        QVERIFY (tracker.waitFor(count));
+    }
+
+    QCOMPARE (tracker.succeeded, count);
+    for (int i = 0; i < count; i++)
+        QVERIFY (manager->operations(QMailMessageId(1 + i)).isEmpty());
+}
+
+
+/**
+ * Stress: the lane never runs out of High operations, yet every Low one
+ * finishes while they keep coming. Checked in scheduling steps rather than
+ * in wall-clock time: of the operations started after a Low one was queued
+ * and before it started (the last time, if preempted), none is due after
+ * it by the deadlines the manager gave them. Without aging, every High one
+ * would go first and no Low one would finish before the load stops.
+ */
+void TestServiceActionManager::lowPriorityLatencyBound()
+{
+    const int deadline = 500;  // ms
+    const int backlog = 8;
+    const int lows = 10;
+    const int interval = 200;  // ms, between Low operations
+
+    FakeMessageServer *server = new FakeMessageServer;
+    FakeMessageServer::Script script;
+    script.latency = 20;
+    server->setDefaultScript(script);
+    ServiceActionManager manager (server);
+    manager.setDeadline(ServiceActionManager::Low, deadline);
+    Tracker tracker (&manager);
+
+    HighLoad load (&manager, QMailAccountId(1), backlog);
+    QHash<quint64, int> queued_at;  // operations started before
+    for (int i = 0; i < lows; i++) {
+        queued_at.insert(manager.retrieveFolderList(QMailAccountId(1), QMailFolderId(1 + i)),
+                         tracker.started.count());
+        Tracker::run(interval);
+    }
+
+    // only a safety net, nothing is measured by it
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < TIMEOUT) {
+        bool done = true;
+        foreach (quint64 serial, queued_at.keys())
+            done = done && tracker.done.contains(serial);
+        if (done)
+            break;
+        Tracker::run(interval);
+    }
+    load.stop();
+
+    int worst = 0;
+    foreach (quint64 serial, queued_at.keys()) {
+        QVERIFY2 (tracker.done.contains(serial), "a Low operation starved");
+        const int started_at = tracker.started.lastIndexOf(serial);
+        QVERIFY (started_at >= queued_at[serial]);
+
+        const qint64 due = tracker.deadlines[serial];
+        for (int i = queued_at[serial]; i < started_at; i++) {
+            const quint64 ahead = tracker.started[i];
+            QVERIFY2 (tracker.deadlines[ahead] <= due,
+                      qPrintable(QString("[%1] due at %2 ran ahead of [%3] due at %4")
+                                 .arg(ahead).arg(tracker.deadlines[ahead]).arg(serial).arg(due)));
+        }
+        worst = qMax(worst, started_at - queued_at[serial]);
+    }
+    QTest::setBenchmarkResult(worst, QTest::Events);  // the most operations run ahead of a Low one
+}
+
+
+
+QTEST_MAIN(TestServiceActionManager)
+
+#include "tst_serviceactionmanager.moc"
@@ -0,0 +1,14 @@
+# settings shared by the benchmarks, sources are taken from the application
+QT += testlib
+
+LIBS += -lqmfclient
+
+CONFIG += testcase warn_on
+
+SRC = $$PWD/..
+INCLUDEPATH += $$SRC
+
+# the sources trace every operation, which would dominate the timings
+DEFINES += QT_NO_DEBUG_OUTPUT
+
+QMAKE_CXXFLAGS += -std=c++0x
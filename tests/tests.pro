@@ -0,0 +1,8 @@
+# QtTest benchmarks, built and run apart from the application:
+#   qmake tests.pro && make && make check
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    serviceactionmanager \
+    folderstree \
+    messagelistdelegate
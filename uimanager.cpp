@@ -5,7 +5,6 @@
 
 // QMF
 #include <qmfclient/qmailaccountlistmodel.h>  // QMailAccountListModel
-#include <qmfclient/qmailmessagelistmodel.h>  // QMailMessageListModel
 
 // project
 #include "context.h"
@@ -13,6 +12,7 @@
 #include "view.h"
 #include "uimanager.h"
 #include "models/folderlistmodel.h"
+#include "models/messagelistcache.h"
 #include "models/messagelistmodel.h"
 #include "models/messagemodel.h"
 #include "widgets/combobox.h"
@@ -85,6 +85,10 @@ View *construct_main_view(QMainWindow *window)
         CONNECT (message_model, SIGNAL(updated()),
                  new UpdateMessageViewStrategy(view, message_model), SLOT(exec()));
 
+        typedef ctx::ExtractMessage<strategy::PrefetchMessageBody, models::MessageModel> PrefetchMessageBodyStrategy;
+        CONNECT (message_model, SIGNAL(loaded()),
+                 new PrefetchMessageBodyStrategy(message_model), SLOT(exec()));
+
         typedef ctx::ExtractMessage<backend_strategy::DownloadMessageBody, models::MessageModel> DownloadMessageBodyStrategy;
         CONNECT (start_download_button, SIGNAL(clicked()),
                  new DownloadMessageBodyStrategy(message_model), SLOT(exec()));
@@ -98,11 +102,12 @@ View *construct_main_view(QMainWindow *window)
     {
         messages_list->setItemDelegate(new widgets::MessageListDelegate(messages_list));
 
-        auto *messagelist_model = new models::MessageListModel(view);
-        messages_list->setModel(messagelist_model);
+        // a model per recently shown folder, the list starts with an empty one
+        auto *messagelist_cache = new models::MessageListCache(messages_list);
+        messagelist_cache->show(QMailFolderId());
 
         typedef ctx::ModelIndex2MessageId<strategy::ShowMessage, models::MessageModel> ShowMessageStrategy;
-        CONNECT_Q (messages_list->selectionModel(), SIGNAL(currentRowChanged(QModelIndex,QModelIndex)),
+        CONNECT_Q (messagelist_cache, SIGNAL(currentRowChanged(QModelIndex,QModelIndex)),
                  new ShowMessageStrategy(message_model), SLOT(exec(QModelIndex)));
 
     }
@@ -116,8 +121,8 @@ View *construct_main_view(QMainWindow *window)
         //ProgressIndicator *progress_indicator = qobject_cast<ProgressIndicator *>(main_view->queryQWidget("progress_indicator"));
 
         auto action_tracker_strategy = new ctx::ActionTracker<QProgressBar,QStatusBar>(0, progress_indicator, status_bar, window);
-        CONNECT (ServiceActionManager::instance(), SIGNAL(progressChanged(quint64,uint,uint)),
-                            action_tracker_strategy, SLOT(progressChanged(quint64,uint,uint)));
+        CONNECT (ServiceActionManager::instance(), SIGNAL(aggregateProgressChanged(uint,uint)),
+                            action_tracker_strategy, SLOT(aggregateProgressChanged(uint,uint)));
         CONNECT (ServiceActionManager::instance(), SIGNAL(activityChanged(quint64,QMailServiceAction::Activity)),
                             action_tracker_strategy, SLOT(activityChanged(quint64,QMailServiceAction::Activity)));
         CONNECT (ServiceActionManager::instance(), SIGNAL(statusChanged(quint64,QMailServiceAction::Status)),
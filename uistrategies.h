@@ -25,6 +25,8 @@
 #include "context.h"
 #include "backendstrategies.h"
 #include "models/folderstreemodel.h"
+#include "models/messagelistcache.h"
+#include "models/messagelistmodel.h"
 #include "models/messagemodel.h"
 #include "models/folderlistmodel.h"
 #include "models/attachmentlistmodel.h"
@@ -57,8 +59,8 @@ namespace strategy {
 
 /**
  * The 'Show Message' routine suppose to reset message viwers's model to a new
- * state. Additionally, it might (depending on preferences) ensure availability
- * of the message.
+ * state. The message is loaded in the background, see PrefetchMessageBody for
+ * what happens when it is.
  *
  * Consider to change arguments for something more generic (a View*).
  */
@@ -69,11 +71,24 @@ public:
     {
         Q_ASSERT (model);
         model->setMessageId(id);
+    }
+};
+
+
 
+/**
+ * Once a message shown is loaded, makes sure (depending on preferences) its
+ * body is available.
+ */
+class PrefetchMessageBody
+{
+public:
+    void operator()(const QMailMessage &message)
+    {
         static const QSettings settings;
         if (settings.value("download_message_body_ondemand", true).toBool()) {
             backend_strategy::DownloadMessageBody download;
-            download(model->message());
+            download(message);
         }
     }
 };
@@ -99,6 +114,14 @@ public:
         auto download_prompt = view->queryQWidget("download_prompt");
         Q_ASSERT (download_prompt);
 
+        if (model->isLoading()) {
+            message_viewer->window()->setWindowTitle(model->metaData().subject());
+            message_viewer->setEnabled(false);
+            message_viewer->setPlainText(QObject::tr("Loading..."));
+            download_prompt->hide();
+            return;
+        }
+
         message_viewer->window()->setWindowTitle(model->message().subject());
 
         if (const auto body_container = find::messageBody(model->message())) {
@@ -150,16 +173,14 @@ public:
         auto messages_list = qobject_cast<QAbstractItemView*>(view->queryQWidget("messages_list"));
         Q_ASSERT (messages_list);
 
-        QMailMessageModelBase *model = qobject_cast<QMailMessageModelBase*>(messages_list->model());
-        Q_ASSERT (model);
+        auto cache = messages_list->findChild<models::MessageListCache*>();
+        Q_ASSERT (cache);
 
-        if (!id.isValid()) {
-            model->setKey(QMailMessageKey::nonMatchingKey());
+        models::MessageListModel *model = cache->show(id);
+        if (!id.isValid())
             return;
-        }
 
         Q_ASSERT (QMailFolder(id).id().isValid());
-        model->setKey(QMailMessageKey::parentFolderId(id));
 
         if (model->isEmpty()) {
              backend_strategy::InitFolder init_folder;
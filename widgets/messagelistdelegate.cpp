@@ -4,8 +4,9 @@
 
 #include <qdebug.h>
 
+#include <QSettings>
+
 #include <qmfclient/qmailmessagemodelbase.h> // QMailMessageModelBase
-#include <qmfclient/qmailmessage.h> // QMailMessageMetaData
 
 // project
 #include "models/messagelistmodel.h"
@@ -194,8 +195,60 @@ private:
 
 
 MessageListDelegate::MessageListDelegate(QObject *parent)
-  : QAbstractItemDelegate (parent)
+  : QAbstractItemDelegate (parent),
+    mLayoutWidth (-1)
 {
+    QSettings settings;
+    // a few screens worth is enough, rows scrolled far away are cheap to redo
+    mLayouts.setMaxCost(settings.value("message_layout_cache_size", 512).toInt());
+}
+
+
+const MessageListDelegate::RowLayout * MessageListDelegate::rowLayout(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    if (option.rect.width() != mLayoutWidth || option.font != mLayoutFont) {
+        mLayouts.clear();
+        mLayoutWidth = option.rect.width();
+        mLayoutFont = option.font;
+    }
+
+    const QMailMessageId &id = index.data(QMailMessageModelBase::MessageIdRole).value<QMailMessageId>();
+    const QString &subject = index.data(models::MessageListModel::SubjectRole).toString();
+    const QString &sender = index.data(models::MessageListModel::SenderRole).toString();
+    const QDateTime &date = index.data(models::MessageListModel::DateRole).toDateTime();
+
+    RowLayout *layout = mLayouts.object(id);
+    if (layout && layout->subject == subject && layout->sender == sender && layout->date == date)
+        return layout;
+
+    layout = new RowLayout;
+    layout->subject = subject;
+    layout->sender = sender;
+    layout->date = date;
+
+    // lay out a row at the origin, painting translates it to the real one
+    QStyleOptionViewItem origin_option(option);
+    origin_option.rect.moveTo(0, 0);
+    MessageListItemOption opt(origin_option, index);
+    opt.dateText = date.toString(Qt::SystemLocaleShortDate);
+
+    layout->topTextRect = opt.topTextRect();
+    layout->bottomTextRect = opt.bottomTextRect();
+    layout->dateRect = opt.dateRect();
+
+    const QFontMetrics &fm = option.fontMetrics;
+    layout->topText.setText(fm.elidedText(subject, Qt::ElideRight, layout->topTextRect.width()));
+    layout->bottomText.setText(fm.elidedText(sender, Qt::ElideRight, layout->bottomTextRect.width()));
+    layout->dateText.setText(opt.dateText);
+
+    QStaticText *texts[] = { &layout->topText, &layout->bottomText, &layout->dateText };
+    for (uint i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        texts[i]->setTextFormat(Qt::PlainText);
+        texts[i]->prepare(QTransform(), option.font);
+    }
+
+    mLayouts.insert(id, layout);
+    return layout;
 }
 
 
@@ -203,11 +256,8 @@ void MessageListDelegate::paint(QPainter *painter, const QStyleOptionViewItem &o
 {
     Q_ASSERT (index.isValid());
     MessageListItemOption opt(option, index);
-
-    const QVariant &data = index.data(QMailMessageModelBase::MessageIdRole);
-    Q_ASSERT (data.canConvert<QMailMessageId>());
-    const QMailMessageMetaData message(data.value<QMailMessageId>());
-    opt.dateText = message.date().toLocalTime().toString(Qt::SystemLocaleShortDate);
+    const RowLayout *layout = rowLayout(option, index);
+    const QPoint &origin = option.rect.topLeft();
 
     painter->save();
     painter->setClipRect(option.rect);
@@ -250,33 +300,15 @@ void MessageListDelegate::paint(QPainter *painter, const QStyleOptionViewItem &o
         else
             painter->setPen(option.palette.color(cg, QPalette::Text));
 
-        const QRect &top_text_rect = opt.topTextRect();
-        painter->drawText(top_text_rect,
-                          Qt::AlignLeft | Qt::AlignVCenter,
-                          option.fontMetrics.elidedText(message.subject(),
-                                                        Qt::ElideRight,
-                                                        top_text_rect.width()));
+        // the text rects are exactly one line high, no vertical centering needed
+        painter->drawStaticText(origin + layout->topTextRect.topLeft(), layout->topText);
     }
 
     // draw sender label
-    {
-        const QRect &bottom_text_rect = opt.bottomTextRect();
-        painter->drawText(bottom_text_rect,
-                          Qt::AlignLeft | Qt::AlignVCenter,
-                          option.fontMetrics.elidedText(message.from().name(),
-                                                        Qt::ElideRight,
-                                                        bottom_text_rect.width()));
-    }
+    painter->drawStaticText(origin + layout->bottomTextRect.topLeft(), layout->bottomText);
 
     // draw date label
-    {
-        const QRect &rect = opt.dateRect();
-        painter->drawText(rect,
-                          Qt::AlignLeft | Qt::AlignVCenter,
-                          option.fontMetrics.elidedText(opt.dateText,
-                                                        Qt::ElideRight,
-                                                        rect.width()));
-    }
+    painter->drawStaticText(origin + layout->dateRect.topLeft(), layout->dateText);
 
     // draw progress info
     const QVariant &progress_data = index.data(models::MessageListModel::ProgressInfoRole);
@@ -4,11 +4,24 @@
 
 
 #include <QAbstractItemDelegate>
+#include <QCache>
+#include <QDateTime>
+#include <QFont>
+#include <QRect>
+#include <QStaticText>
+
+#include <qmfclient/qmailid.h>
 
 namespace widgets {
 
 
 
+/**
+ * Rows are laid out once and cached by message id: rects relative to the
+ * row, the formatted date and the elided subject and sender as QStaticText.
+ * An entry is rebuilt when the row's data differs from what it was built
+ * from; the whole cache is dropped when the font or the row width changes.
+ */
 class MessageListDelegate : public QAbstractItemDelegate
 {
     Q_OBJECT
@@ -41,6 +54,27 @@ protected:
     bool editorEvent(QEvent *event, QAbstractItemModel *model, const QStyleOptionViewItem &option, const QModelIndex &index);
 
 private:
+    struct RowLayout
+    {
+        // what the layout was built from
+        QString subject;
+        QString sender;
+        QDateTime date;
+
+        QRect topTextRect;  // relative to the row's top left
+        QRect bottomTextRect;
+        QRect dateRect;
+        QStaticText topText;
+        QStaticText bottomText;
+        QStaticText dateText;
+    };
+
+    const RowLayout * rowLayout(const QStyleOptionViewItem &option, const QModelIndex &index) const;
+
+    mutable QCache<QMailMessageId, RowLayout> mLayouts;
+    mutable QFont mLayoutFont;
+    mutable int mLayoutWidth;
+
 //    Q_DECLARE_PRIVATE(MessageListDelegate)
 //    Q_DISABLE_COPY(MessageListDelegate)
 